@@ -1,76 +1,65 @@
 #include "procsim.hpp"
-#include <deque>
+#include "procsim_digest.hpp"
+#include "procsim_log.hpp"
 #include <vector>
 #include <algorithm>
 #include <cstdio>
-#include <map>
-#include <set>
-
-// global processor states
-uint64_t RESULT_BUSES;
-uint64_t K0_FU_COUNT;
-uint64_t K1_FU_COUNT;
-uint64_t K2_FU_COUNT;
-uint64_t FETCH_RATE;
-
-// dispatch queue
-std::deque<proc_inst_t> dispatch_queue;
-// reserved slots (for dispatching to RS)
-uint64_t reserved_slots = 0;
-
-// reservation station
-std::vector<rs_entry_t> reservation_station;
-
-// result bus structure (matching reference)
-struct ResultBus {
-    bool busy;
-    uint64_t tag;
-    int32_t reg;
-};
-std::vector<ResultBus> result_buses;
-
-// instructions completed and waiting for state update
-std::vector<std::pair<uint32_t, rs_entry_t*>> completed_instructions; // (op_code, entry)
-
-const int32_t NUM_REGISTERS = 128;
-// the latest dispatched writer to this register, and whether the register is ready
-struct RegisterStatus {
-    uint64_t tag;
-    bool ready;
-};
-// register ready table
-RegisterStatus register_status[NUM_REGISTERS];
-
-// FU counters: tracks how many FUs are currently in use
-uint64_t k0_counter = 0;
-uint64_t k1_counter = 0;
-uint64_t k2_counter = 0;
-
-// global counters
-uint64_t global_tag_counter = 0;
-uint64_t current_cycle = 0;
-
-// statistics tracking
-uint64_t max_disp_size = 0;
-uint64_t total_disp_size = 0;
-uint64_t instructions_fired = 0;
-uint64_t instructions_retired = 0;
-bool done_fetching = false;
-
-FILE* logging = fopen("log.txt", "w");
-FILE* output = fopen("output.output", "w");
-
-// Track instruction cycle info for output
-struct InstructionCycles {
-    uint64_t fetch;
-    uint64_t dispatch;
-    uint64_t schedule;
-    uint64_t execute;
-    uint64_t state_update;
-};
-std::map<uint64_t, InstructionCycles> instruction_cycles;
-
-void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f) 
+#include <chrono>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace procsim;
+
+// PipelineCounters sampling, compiled out with PROCSIM_NO_COUNTERS
+#ifdef PROCSIM_NO_COUNTERS
+#define COUNT(x)
+#else
+#define COUNT(x) x
+#endif
+
+const uint32_t Core::NO_DEP;
+
+Core::Core(InstructionSource* source, EventLog* logging, FILE* output, log_level_t level)
+    : source(source), stats_sink(NULL), stage_times(NULL), progress_sink(NULL), progress_cycles(0),
+      progress_seconds(0.0), progress_anchored(false), progress_next(0), progress_last_cycle(0),
+      progress_last_retired(0), logging(level >= LOG_EVENTS ? logging : NULL),
+      output(level >= LOG_STATS ? output : NULL), timing_log(NULL), digest(NULL), timing_rows(level >= LOG_EVENTS), extended_stats(false),
+      RESULT_BUSES(0), K0_FU_COUNT(0), K1_FU_COUNT(0), K2_FU_COUNT(0), FETCH_RATE(0),
+      dispatch_limit(0), reserved_slots(0), free_count(0), rs_layout(RS_LAYOUT_LISTS),
+      k0_counter(0), k1_counter(0), k2_counter(0), wheel_mask(0), wheel_count(0),
+      global_tag_counter(0), current_cycle(0), max_disp_size(0), total_disp_size(0),
+      instructions_fired(0), instructions_retired(0), done_fetching(false), bus_demand_peak(0), deadlock(false),
+      blocked_count(0), blocked_types(0)
+{
+    for (int t = 0; t < FU_TYPES; t++) {
+        fu_timing.latency[t] = DEFAULT_FU_LATENCY;
+        fu_timing.pipelined[t] = false;
+        bus_arbitration.order[t] = t;
+    }
+    bus_arbitration.policy = BUS_OLDEST_FIRST;
+}
+
+void Core::set_fu_timing(const fu_timing_t& timing)
+{
+    fu_timing = timing;
+}
+
+void Core::set_progress(ProgressSink* sink, uint64_t cycles, double seconds)
+{
+    progress_sink = (cycles > 0 || seconds > 0.0) ? sink : NULL;
+    progress_cycles = cycles;
+    progress_seconds = seconds;
+    progress_anchored = false;
+    progress_next = 0;
+}
+
+void Core::reset()
+{
+    setup_proc(RESULT_BUSES, K0_FU_COUNT, K1_FU_COUNT, K2_FU_COUNT, FETCH_RATE);
+}
+
+void Core::setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f) 
 {
     RESULT_BUSES = r;
     K0_FU_COUNT = k0;
@@ -78,18 +67,50 @@ void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f)
     K2_FU_COUNT = k2;
     FETCH_RATE = f;
 
-    dispatch_queue.clear();
+    // the previous run's buffers all go at once; everything below is carved
+    // from the arena again in the same order
+    arena.reset();
+    Arena* a = &arena;
+    arena_attach(fetch_buffer, a);
+    arena_attach(reservation_station, a);
+    arena_attach(free_mask, a);
+    arena_attach(ready_queue, a);
+    arena_attach(broadcast_now, a);
+    arena_attach(retiring, a);
+    arena_attach(scratch, a);
+    arena_attach(soa_tag, a);
+    for (int i = 0; i < 2; i++) {
+        arena_attach(soa_parent[i], a);
+        arena_attach(src_ready_mask[i], a);
+    }
+    arena_attach(fired_mask, a);
+    arena_attach(dep_head, a);
+    arena_attach(dep_next, a);
+    arena_attach(wakeups, a);
+    arena_attach(result_buses, a);
+    arena_attach(wheel, a);
+
+    fetch_buffer.resize(FETCH_RATE);
+    dispatch_queue.attach(a);
+    dispatch_queue.reserve(dispatch_limit);
     reservation_station.clear();
-    completed_instructions.clear();
 
-    fprintf(logging, "CYCLE\tOPERATION\tINSTRUCTION\n");
-    fprintf(output, "Processor Settings\n");
-    fprintf(output, "R: %llu\n", r);
-    fprintf(output, "k0: %llu\n", k0);
-    fprintf(output, "k1: %llu\n", k1);
-    fprintf(output, "k2: %llu\n", k2);
-    fprintf(output, "F: %llu\n", f);
-    fprintf(output, "\n");
+    if (logging) logging->begin();
+    if (output) {
+        fprintf(output, "Processor Settings\n");
+        fprintf(output, "R: %llu\n", (unsigned long long)r);
+        fprintf(output, "k0: %llu\n", (unsigned long long)k0);
+        fprintf(output, "k1: %llu\n", (unsigned long long)k1);
+        fprintf(output, "k2: %llu\n", (unsigned long long)k2);
+        fprintf(output, "F: %llu\n", (unsigned long long)f);
+        fprintf(output, "\n");
+    }
+    if (output && timing_rows && timing_log == NULL) {
+        fprintf(output, "INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n");
+    }
+    if (timing_log && timing_rows) timing_log->begin();
+    if (digest) digest->begin();
+    instruction_cycles.reset(output, timing_rows ? timing_log : NULL, a);
 
     uint64_t rs_size = 2 * (K0_FU_COUNT + K1_FU_COUNT + K2_FU_COUNT);
     reservation_station.resize(rs_size);
@@ -97,6 +118,34 @@ void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f)
         entry.valid = false;
     }
 
+    // every slot starts free; the activity lists never outgrow the RS
+    free_mask.assign((rs_size + 63) / 64, 0);
+    free_count = 0;
+    for (uint64_t i = 0; i < rs_size; i++) {
+        release_slot((uint32_t)i);
+    }
+    ready_queue.clear();
+    broadcast_now.clear();
+    retiring.clear();
+    // nothing waits for a bus without holding an RS slot
+    completed_instructions.reset(rs_size, a);
+    ready_queue.reserve(rs_size);
+    broadcast_now.reserve(rs_size);
+    retiring.reserve(rs_size);
+    scratch.reserve(rs_size);
+    size_t words = free_mask.size();
+    soa_tag.assign(words * 64, 0);
+    for (int i = 0; i < 2; i++) {
+        // padding slots never match a broadcast tag
+        soa_parent[i].assign(words * 64, UINT64_MAX);
+        src_ready_mask[i].assign(words, 0);
+    }
+    fired_mask.assign(words, 0);
+    dep_head.assign(rs_size, NO_DEP);
+    dep_next.assign(rs_size * 2, NO_DEP);
+    wakeups.clear();
+    wakeups.reserve(rs_size);
+
     // Initialize result buses
     result_buses.resize(RESULT_BUSES);
     for (auto& bus : result_buses) {
@@ -110,9 +159,27 @@ void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f)
     k1_counter = 0;
     k2_counter = 0;
 
+    // the wheel must not wrap onto a bucket that is still pending
+    uint64_t max_latency = 1;
+    for (int t = 0; t < FU_TYPES; t++) {
+        if (fu_timing.latency[t] == 0) fu_timing.latency[t] = 1;
+        max_latency = std::max(max_latency, fu_timing.latency[t]);
+        fu_issued[t] = 0;
+    }
+    uint64_t wheel_size = 2;
+    while (wheel_size <= max_latency) wheel_size *= 2;
+    wheel.resize(wheel_size);
+    for (auto& bucket : wheel) {
+        arena_attach(bucket, a);
+        bucket.reserve(rs_size);
+    }
+    wheel_mask = wheel_size - 1;
+    wheel_count = 0;
+
     for (int32_t i = 0; i < NUM_REGISTERS; i++) {
         register_status[i].tag = 0;
         register_status[i].ready = true;
+        register_status[i].slot = 0;
     }
 
     global_tag_counter = 0;
@@ -122,14 +189,112 @@ void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f)
     instructions_fired = 0;
     instructions_retired = 0;
     done_fetching = false;
-    instruction_cycles.clear();
+    bus_demand_peak = 0;
+    deadlock = false;
+    progress_anchored = false;
+    progress_next = 0;
+
+    counters.dispatch_stall_cycles = 0;
+    for (int t = 0; t < FU_TYPES; t++) {
+        counters.fu_stall_cycles[t] = 0;
+    }
+    counters.bus_overflow_cycles = 0;
+    counters.ready_not_fired = 0;
+    counters.rs_occupancy.assign(rs_size + 1, 0);
 }
 
-bool all_rs_empty();
+void Core::run_proc()
+{
+    run_until(NO_EVENT);
+}
 
-void run_proc(proc_stats_t* p_stats)
+bool Core::run_until(uint64_t cycle)
 {
-    while (!done_fetching || !dispatch_queue.empty() || !all_rs_empty()) {
+    run_cycles(cycle);
+
+    return !deadlock && (!done_fetching || !dispatch_queue.empty() || !all_rs_empty());
+}
+
+void Core::read_counters(proc_counters_t* counters) const
+{
+    counters->cycles = current_cycle;
+    counters->retired = instructions_retired;
+    counters->fired = instructions_fired;
+    counters->total_disp_size = total_disp_size;
+    counters->max_disp_size = max_disp_size;
+}
+
+uint64_t Core::warm(uint64_t n)
+{
+    if (done_fetching || !dispatch_queue.empty() || !all_rs_empty()) return 0;
+
+    uint64_t skipped = source->skip(n);
+    if (skipped < n) {
+        done_fetching = true;
+    }
+    global_tag_counter += skipped;
+    instruction_cycles.skip_to(global_tag_counter);
+    return skipped;
+}
+
+void Core::run_cycles(uint64_t stop_cycle)
+{
+    if (rs_layout == RS_LAYOUT_SOA) {
+#define PROCSIM_RUN_FIXED(R, K0, K1, K2, F) \
+        if (Simulator<R, K0, K1, K2, F>::matches(RESULT_BUSES, K0_FU_COUNT, K1_FU_COUNT, K2_FU_COUNT, FETCH_RATE)) { \
+            run_fixed<Simulator<R, K0, K1, K2, F>::Soa>(stop_cycle); \
+            return; \
+        }
+        PROCSIM_FIXED_SHAPES(PROCSIM_RUN_FIXED)
+#undef PROCSIM_RUN_FIXED
+    }
+    DynamicSoaRS soa = soa_view();
+    run_cycles(stop_cycle, soa);
+}
+
+template <class Soa>
+void Core::run_fixed(uint64_t stop_cycle)
+{
+    DynamicSoaRS view = soa_view();
+    Soa soa;
+    soa.load(view);
+    run_cycles(stop_cycle, soa);
+    soa.store(view);
+}
+
+DynamicSoaRS Core::soa_view()
+{
+    DynamicSoaRS view;
+    view.words = free_mask.size();
+    view.tag = soa_tag.data();
+    view.fired = fired_mask.data();
+    for (int i = 0; i < 2; i++) {
+        view.parent[i] = soa_parent[i].data();
+        view.src_ready[i] = src_ready_mask[i].data();
+    }
+    return view;
+}
+
+template <class Soa>
+void Core::run_cycles(uint64_t stop_cycle, Soa& soa)
+{
+    while (!deadlock && current_cycle < stop_cycle && (!done_fetching || !dispatch_queue.empty() || !all_rs_empty())) {
+        // fast-forward over cycles in which no stage can do anything
+        uint64_t next = next_event_cycle(soa);
+        if (next == NO_EVENT) {
+            fprintf(stderr, "Pipeline deadlocked at cycle %llu (an op type with no FUs or no result buses?)\n",
+                    (unsigned long long)current_cycle);
+            deadlock = true;
+            break;
+        }
+        if (next > stop_cycle) {
+            skip_idle_cycles(stop_cycle - current_cycle, soa);
+            break;
+        }
+        if (next > current_cycle + 1) {
+            skip_idle_cycles(next - current_cycle - 1, soa);
+        }
+
         current_cycle++;
 
         bool firstHalf = false;
@@ -137,19 +302,176 @@ void run_proc(proc_stats_t* p_stats)
         do {
             firstHalf = !firstHalf;
 
-            state_update_stage(firstHalf);
-            execute_stage(firstHalf);
-            schedule_stage(firstHalf);
-            dispatch_stage(firstHalf);
-            fetch_stage(firstHalf);
+            if (stage_times) {
+                run_timed_half(firstHalf, soa);
+            } else {
+                state_update_stage(firstHalf);
+                execute_stage(firstHalf);
+                schedule_stage(firstHalf, soa);
+                dispatch_stage(firstHalf, soa);
+                fetch_stage(firstHalf);
+            }
 
         } while (firstHalf);
+
+        if (digest) {
+            digest->end_cycle(current_cycle, global_tag_counter, instructions_fired, instructions_retired,
+                              dispatch_queue.size(), reservation_station.size() - free_count);
+        }
+        if (progress_sink && current_cycle >= progress_next) {
+            poll_progress();
+        }
+    }
+}
+
+void Core::poll_progress()
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point now = clock::now();
+    uint64_t step = progress_cycles ? progress_cycles : PROGRESS_POLL_CYCLES;
+    progress_next = (current_cycle / step + 1) * step;
+
+    bool due = progress_cycles ? true : std::chrono::duration<double>(now - progress_last_time).count() >= progress_seconds;
+    if (!progress_anchored || !due) {
+        if (!progress_anchored) {
+            progress_anchored = true;
+            progress_last_time = now;
+            progress_last_cycle = current_cycle;
+            progress_last_retired = instructions_retired;
+        }
+        return;
+    }
+
+    progress_snapshot_t s;
+    s.cycle = current_cycle;
+    s.retired = instructions_retired;
+    s.ipc = current_cycle ? (double)instructions_retired / (double)current_cycle : 0.0;
+    s.dispatch_queue = dispatch_queue.size();
+    s.rs_size = reservation_station.size();
+    s.rs_used = s.rs_size - free_count;
+    s.host_seconds = std::chrono::duration<double>(now - progress_last_time).count();
+    double seconds = s.host_seconds > 0.0 ? s.host_seconds : 1e-9;
+    s.host_cycles_per_sec = (current_cycle - progress_last_cycle) / seconds;
+    s.host_inst_per_sec = (instructions_retired - progress_last_retired) / seconds;
+    progress_sink->snapshot(s);
+
+    progress_last_time = now;
+    progress_last_cycle = current_cycle;
+    progress_last_retired = instructions_retired;
+}
+
+void TextProgressSink::snapshot(const progress_snapshot_t& s)
+{
+    fprintf(out, "progress cycle=%llu retired=%llu ipc=%f dispatch_queue=%llu rs=%llu/%llu "
+            "host_cycles_per_sec=%.0f host_inst_per_sec=%.0f\n",
+            (unsigned long long)s.cycle, (unsigned long long)s.retired, s.ipc,
+            (unsigned long long)s.dispatch_queue, (unsigned long long)s.rs_used, (unsigned long long)s.rs_size,
+            s.host_cycles_per_sec, s.host_inst_per_sec);
+    fflush(out);
+}
+
+template <class Soa>
+void Core::run_timed_half(bool firstHalf, Soa& soa)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point t0 = clock::now();
+    state_update_stage(firstHalf);
+    clock::time_point t1 = clock::now();
+    execute_stage(firstHalf);
+    clock::time_point t2 = clock::now();
+    schedule_stage(firstHalf, soa);
+    clock::time_point t3 = clock::now();
+    dispatch_stage(firstHalf, soa);
+    clock::time_point t4 = clock::now();
+    fetch_stage(firstHalf);
+    clock::time_point t5 = clock::now();
+
+    stage_times->state_update += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    stage_times->execute += std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+    stage_times->schedule += std::chrono::duration_cast<std::chrono::nanoseconds>(t3 - t2).count();
+    stage_times->dispatch += std::chrono::duration_cast<std::chrono::nanoseconds>(t4 - t3).count();
+    stage_times->fetch += std::chrono::duration_cast<std::chrono::nanoseconds>(t5 - t4).count();
+    stage_times->halves++;
+}
+
+template <class Soa>
+uint64_t Core::next_event_cycle(Soa& soa)
+{
+    uint64_t next = current_cycle + 1;
+
+    // work that is always picked up in the very next cycle
+    if (!retiring.empty()) return next;
+    if (!done_fetching && (dispatch_limit == 0 || dispatch_queue.size() < dispatch_limit)) return next;
+    if (!completed_instructions.empty() && RESULT_BUSES > 0) return next;
+    if (!dispatch_queue.empty() && free_count > 0) return next;
+    for (int t = 0; t < FU_TYPES; t++) {
+        if (fu_issued[t] > 0) return next;
+    }
+
+    // FU counters otherwise only drop at a broadcast, so a blocked ready
+    // queue stays blocked until something completes
+    if (rs_layout == RS_LAYOUT_SOA) {
+        for (size_t w = 0; w < soa.word_count(); w++) {
+            uint64_t ready = ~free_mask[w] & ~soa.fired[w] & soa.src_ready[0][w] & soa.src_ready[1][w];
+            for (; ready != 0; ready &= ready - 1) {
+                int32_t op_code = reservation_station[w * 64 + __builtin_ctzll(ready)].instruction.op_code;
+                if (*get_counter(op_code) < get_fu_count(op_code)) return next;
+            }
+        }
+    }
+    for (uint32_t slot : ready_queue) {
+        int32_t op_code = reservation_station[slot].instruction.op_code;
+        if (*get_counter(op_code) < get_fu_count(op_code)) return next;
     }
 
-    // complete_proc(p_stats);
+    // otherwise the next completion on the wheel
+    if (wheel_count > 0) {
+        for (uint64_t cycle = next; ; cycle++) {
+            if (!wheel[cycle & wheel_mask].empty()) return cycle;
+        }
+    }
+
+    return NO_EVENT;
 }
 
-void complete_proc(proc_stats_t *p_stats) 
+template <class Soa>
+void Core::skip_idle_cycles(uint64_t cycles, Soa& soa)
+{
+    // an idle cycle only ages the dispatch queue statistics
+    current_cycle += cycles;
+    total_disp_size += cycles * dispatch_queue.size();
+
+    // and repeats the samples of the last cycle that could not act: nothing
+    // queued can dispatch and every ready op is blocked on its FU type
+    COUNT(
+        if (!dispatch_queue.empty()) counters.dispatch_stall_cycles += cycles;
+        counters.rs_occupancy[reservation_station.size() - free_count] += cycles;
+        blocked_count = 0;
+        blocked_types = 0;
+        if (rs_layout == RS_LAYOUT_SOA) {
+            for (size_t w = 0; w < soa.word_count(); w++) {
+                uint64_t ready = ~free_mask[w] & ~soa.fired[w] & soa.src_ready[0][w] & soa.src_ready[1][w];
+                for (; ready != 0; ready &= ready - 1) {
+                    count_blocked((uint32_t)(w * 64 + __builtin_ctzll(ready)));
+                }
+            }
+        } else {
+            for (uint32_t slot : ready_queue) count_blocked(slot);
+        }
+        for (int t = 0; t < FU_TYPES; t++) {
+            if (blocked_types & (1u << t)) counters.fu_stall_cycles[t] += cycles;
+        }
+        counters.ready_not_fired += cycles * blocked_count;
+    )
+}
+
+void Core::count_blocked(uint32_t slot)
+{
+    blocked_count++;
+    blocked_types |= 1u << fu_type(reservation_station[slot].instruction.op_code);
+}
+
+void Core::complete_proc(proc_stats_t *p_stats) 
 {
     p_stats->retired_instruction = instructions_retired;
     p_stats->cycle_count = current_cycle;
@@ -170,18 +492,23 @@ void complete_proc(proc_stats_t *p_stats)
         p_stats->avg_disp_size = 0.0;
     }
 
-    // print the cycle to the output file
-    fprintf(output, "INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n");
-    for (const auto& pair : instruction_cycles) {
-        const auto& cycles = pair.second;
-        fprintf(output, "%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n", 
-               (unsigned long long)(pair.first + 1),  // 1-indexed like reference
-               (unsigned long long)cycles.fetch, 
-               (unsigned long long)cycles.dispatch, 
-               (unsigned long long)cycles.schedule, 
-               (unsigned long long)cycles.execute, 
-               (unsigned long long)cycles.state_update);
+    if (stats_sink) {
+        stats_sink->report(RESULT_BUSES, K0_FU_COUNT, K1_FU_COUNT, K2_FU_COUNT, FETCH_RATE, *p_stats);
+    }
+    if (logging) {
+        logging->flush();
+    }
+    if (timing_log && timing_rows) {
+        timing_log->flush();
     }
+    if (digest) {
+        digest->finish(current_cycle);
+    }
+    if (output == NULL) {
+        return;
+    }
+
+    // the timing rows were written as instructions retired
     fprintf(output, "\nProcessor stats:\n");
 	fprintf(output, "Total instructions: %lu\n", p_stats->retired_instruction);
     fprintf(output, "Avg Dispatch queue size: %f\n", p_stats->avg_disp_size);
@@ -189,27 +516,136 @@ void complete_proc(proc_stats_t *p_stats)
     fprintf(output, "Avg inst fired per cycle: %f\n", p_stats->avg_inst_fired);
 	fprintf(output, "Avg inst retired per cycle: %f\n", p_stats->avg_inst_retired);
 	fprintf(output, "Total run time (cycles): %lu\n", p_stats->cycle_count);
+    if (extended_stats) {
+        print_counters(output);
+    }
 }
 
-void fetch_stage(bool firstHalf) {
-    if (!firstHalf) {
-        for (uint64_t i = 0; i < FETCH_RATE; i++) {
-            proc_inst_t inst;
-            if (read_instruction(&inst)) {
-                inst.tag = global_tag_counter++;
-                dispatch_queue.push_back(inst);
+void Core::print_counters(FILE* out) const
+{
+    fprintf(out, "\nPipeline counters:\n");
+    fprintf(out, "Dispatch stalls, RS full (cycles): %llu\n", (unsigned long long)counters.dispatch_stall_cycles);
+    for (int t = 0; t < FU_TYPES; t++) {
+        fprintf(out, "Schedule stalls, k%d busy (cycles): %llu\n", t, (unsigned long long)counters.fu_stall_cycles[t]);
+    }
+    fprintf(out, "Result bus overflow (cycles): %llu\n", (unsigned long long)counters.bus_overflow_cycles);
+    fprintf(out, "Avg ready but not fired: %f\n",
+            current_cycle ? (double)counters.ready_not_fired / (double)current_cycle : 0.0);
+    fprintf(out, "RS occupancy (entries: cycles):\n");
+    for (size_t n = 0; n < counters.rs_occupancy.size(); n++) {
+        fprintf(out, "%llu: %llu\n", (unsigned long long)n, (unsigned long long)counters.rs_occupancy[n]);
+    }
+}
 
-                fprintf(logging, "%llu\tFETCHED\t%llu\n", current_cycle, inst.tag + 1);
+void Core::print_json(FILE* out, const proc_stats_t& stats) const
+{
+    fprintf(out, "{\n");
+    fprintf(out, "  \"config\": {\"R\": %llu, \"k0\": %llu, \"k1\": %llu, \"k2\": %llu, \"F\": %llu},\n",
+            (unsigned long long)RESULT_BUSES, (unsigned long long)K0_FU_COUNT, (unsigned long long)K1_FU_COUNT,
+            (unsigned long long)K2_FU_COUNT, (unsigned long long)FETCH_RATE);
+    fprintf(out, "  \"stats\": {\"retired_instruction\": %lu, \"cycle_count\": %lu, \"avg_inst_retired\": %f, "
+            "\"avg_inst_fired\": %f, \"avg_disp_size\": %f, \"max_disp_size\": %lu},\n",
+            stats.retired_instruction, stats.cycle_count, stats.avg_inst_retired, stats.avg_inst_fired,
+            stats.avg_disp_size, stats.max_disp_size);
+    fprintf(out, "  \"counters\": {\"dispatch_stall_cycles\": %llu, \"fu_stall_cycles\": [%llu, %llu, %llu], "
+            "\"bus_overflow_cycles\": %llu, \"ready_not_fired\": %llu, \"rs_occupancy\": [",
+            (unsigned long long)counters.dispatch_stall_cycles, (unsigned long long)counters.fu_stall_cycles[0],
+            (unsigned long long)counters.fu_stall_cycles[1], (unsigned long long)counters.fu_stall_cycles[2],
+            (unsigned long long)counters.bus_overflow_cycles, (unsigned long long)counters.ready_not_fired);
+    for (size_t n = 0; n < counters.rs_occupancy.size(); n++) {
+        fprintf(out, "%s%llu", n ? ", " : "", (unsigned long long)counters.rs_occupancy[n]);
+    }
+    fprintf(out, "]}\n}\n");
+}
 
-                // record the fetch cycle
-                instruction_cycles[inst.tag].fetch = current_cycle;
-                instruction_cycles[inst.tag].dispatch = current_cycle + 1;
-            } else {
+void TimingWindow::reset(FILE* output, ColumnarTimingLog* columnar, Arena* arena)
+{
+    this->output = output;
+    this->columnar = columnar;
+    base = 0;
+    mask = 0;
+    arena_attach(rows, arena);
+    arena_attach(done, arena);
+}
+
+void TimingWindow::pending(std::vector<std::pair<uint64_t, InstructionCycles> >& out) const
+{
+    out.clear();
+    for (uint64_t i = 0; i < rows.size(); i++) {
+        uint64_t tag = base + i;
+        if (done[tag & mask]) out.push_back(std::make_pair(tag, rows[tag & mask]));
+    }
+}
+
+void TimingWindow::grow(uint64_t span)
+{
+    size_t size = rows.empty() ? 64 : rows.size();
+    while (size <= span) size *= 2;
+
+    ArenaVector<InstructionCycles> bigger_rows(size, InstructionCycles(), rows.get_allocator());
+    ArenaVector<bool> bigger_done(size, false, done.get_allocator());
+    for (size_t i = 0; i < rows.size(); i++) {
+        uint64_t tag = base + i;
+        bigger_rows[tag & (size - 1)] = rows[tag & mask];
+        bigger_done[tag & (size - 1)] = done[tag & mask];
+    }
+    rows.swap(bigger_rows);
+    done.swap(bigger_done);
+    mask = size - 1;
+}
+
+void TimingWindow::retire(uint64_t tag, const InstructionCycles& cycles)
+{
+    if (tag - base >= rows.size()) {
+        grow(tag - base);
+    }
+    rows[tag & mask] = cycles;
+    done[tag & mask] = true;
+
+    // write out the longest fully retired prefix
+    while (done[base & mask]) {
+        const InstructionCycles& row = rows[base & mask];
+        if (columnar) {
+            uint64_t stages[TIMING_COLUMNS] = { row.fetch, row.dispatch, row.schedule, row.execute, row.state_update };
+            columnar->row(base, stages);
+        } else {
+            fprintf(output, "%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n", 
+                   (unsigned long long)(base + 1),  // 1-indexed like reference
+                   (unsigned long long)row.fetch, 
+                   (unsigned long long)row.dispatch, 
+                   (unsigned long long)row.schedule, 
+                   (unsigned long long)row.execute, 
+                   (unsigned long long)row.state_update);
+        }
+        done[base & mask] = false;
+        base++;
+    }
+}
+
+void Core::fetch_stage(bool firstHalf) {
+    if (!firstHalf) {
+        // back-pressure: fetch only what the dispatch queue has room for
+        uint64_t fetch_rate = FETCH_RATE;
+        if (dispatch_limit != 0) {
+            fetch_rate = std::min(fetch_rate, dispatch_limit - std::min(dispatch_limit, (uint64_t)dispatch_queue.size()));
+        }
+        uint64_t fetched = 0;
+        if (fetch_rate > 0 && !done_fetching) {
+            fetched = source->read(fetch_buffer.data(), fetch_rate);
+            if (fetched < fetch_rate) {
                 done_fetching = true;
-                break;
             }
         }
 
+        for (uint64_t i = 0; i < fetched; i++) {
+            proc_inst_t& inst = fetch_buffer[i];
+            inst.tag = global_tag_counter++;
+            // record the fetch cycle
+            dispatch_queue.push_back(inst, current_cycle);
+
+            if (logging) logging->event(current_cycle, EVENT_FETCHED, inst.tag);
+        }
+
         // Track dispatch queue size AFTER fetching (like reference)
         total_disp_size += dispatch_queue.size();
         if (dispatch_queue.size() > max_disp_size) {
@@ -218,63 +654,118 @@ void fetch_stage(bool firstHalf) {
     }
 }
 
-void dispatch_stage(bool firstHalf) {
+void Core::dispatch_stage(bool firstHalf) {
+    DynamicSoaRS soa = soa_view();
+    dispatch_stage(firstHalf, soa);
+}
+
+template <class Soa>
+void Core::dispatch_stage(bool firstHalf, Soa& soa) {
     if (firstHalf) {
         // Reserve slots in RS - minimum of available slots and dispatch queue size
-        uint64_t available_slots = 0;
-        for (const auto& entry : reservation_station) {
-            if (!entry.valid) {
-                available_slots++;
-            }
-        }
-        reserved_slots = std::min(available_slots, (uint64_t)dispatch_queue.size());
+        reserved_slots = std::min(free_count, (uint64_t)dispatch_queue.size());
+        COUNT(
+            if (dispatch_queue.size() > free_count) counters.dispatch_stall_cycles++;
+            counters.rs_occupancy[reservation_station.size() - free_count]++;
+        )
     } else {
-        // Add reserved_slots instructions to RS
-        uint64_t dispatched = 0;
-        for (size_t i = 0; i < reservation_station.size() && dispatched < reserved_slots && !dispatch_queue.empty(); i++) {
-            if (!reservation_station[i].valid) {
-                proc_inst_t inst = dispatch_queue.front();
-                dispatch_queue.pop_front();
-
-                // create the new RS entry
-                rs_entry_t& entry = reservation_station[i];
-                entry.valid = true;
-                entry.instruction = inst;
-
-                // check whether srcs are ready
-                entry.src1_ready = (inst.src_reg[0] == -1) || register_status[inst.src_reg[0]].ready;
-                entry.src2_ready = (inst.src_reg[1] == -1) || register_status[inst.src_reg[1]].ready;
-
-                // store parent tags for wakeup
-                entry.src1_parent = (inst.src_reg[0] != -1 && !entry.src1_ready) ? register_status[inst.src_reg[0]].tag : 0;
-                entry.src2_parent = (inst.src_reg[1] != -1 && !entry.src2_ready) ? register_status[inst.src_reg[1]].tag : 0;
-
-                entry.fired = false;
-                entry.completed = false;
-                entry.state_updated = false;
-                entry.completed_cycle = 0;
-
-                // log the dispatch
-                fprintf(logging, "%llu\tDISPATCHED\t%llu\n", current_cycle, inst.tag + 1);
-
-                // record dispatch and set schedule to next cycle (like reference)
-                // Note: reference sets schedule = cycle_count + 1 at dispatch time
-                instruction_cycles[inst.tag].schedule = current_cycle + 1;
-
-                // mark destination register as not ready
-                if (inst.dest_reg != -1) {
-                    register_status[inst.dest_reg].ready = false;
-                    register_status[inst.dest_reg].tag = inst.tag;
-                }
+        // Add reserved_slots instructions to RS, lowest free slot first
+        for (uint64_t dispatched = 0; dispatched < reserved_slots && !dispatch_queue.empty(); dispatched++) {
+            uint32_t slot = take_free_slot();
+            proc_inst_t inst = dispatch_queue.front().inst;
+            uint64_t fetch_cycle = dispatch_queue.front().fetch_cycle;
+            dispatch_queue.pop_front();
+
+            // create the new RS entry
+            rs_entry_t& entry = reservation_station[slot];
+            entry.valid = true;
+            entry.instruction = inst;
+            // the reference reports DISP as the cycle after fetch
+            entry.fetch_cycle = fetch_cycle;
+            entry.dispatch_cycle = fetch_cycle + 1;
+
+            // check whether srcs are ready
+            entry.src1_ready = (inst.src_reg[0] == -1) || register_status[inst.src_reg[0]].ready;
+            entry.src2_ready = (inst.src_reg[1] == -1) || register_status[inst.src_reg[1]].ready;
+
+            // store parent tags for wakeup
+            entry.src1_parent = (inst.src_reg[0] != -1 && !entry.src1_ready) ? register_status[inst.src_reg[0]].tag : 0;
+            entry.src2_parent = (inst.src_reg[1] != -1 && !entry.src2_ready) ? register_status[inst.src_reg[1]].tag : 0;
+
+            entry.fired = false;
+            entry.completed = false;
+            entry.state_updated = false;
+            entry.completed_cycle = 0;
+
+            // the newest tag always goes to the back of the ready queue;
+            // otherwise wait on the producers' broadcasts
+            if (rs_layout == RS_LAYOUT_SOA) {
+                // readiness lives in the bitmasks, which only this layout keeps
+                uint64_t bit = 1ULL << (slot % 64);
+                soa.tag[slot] = inst.tag;
+                soa.parent[0][slot] = entry.src1_parent;
+                soa.parent[1][slot] = entry.src2_parent;
+                soa.fired[slot / 64] &= ~bit;
+                soa.src_ready[0][slot / 64] = entry.src1_ready ? (soa.src_ready[0][slot / 64] | bit) : (soa.src_ready[0][slot / 64] & ~bit);
+                soa.src_ready[1][slot / 64] = entry.src2_ready ? (soa.src_ready[1][slot / 64] | bit) : (soa.src_ready[1][slot / 64] & ~bit);
+            } else if (entry.src1_ready && entry.src2_ready) {
+                ready_queue.push_back(slot);
+            } else {
+                if (!entry.src1_ready) add_dependent(register_status[inst.src_reg[0]].slot, slot, 0);
+                if (!entry.src2_ready) add_dependent(register_status[inst.src_reg[1]].slot, slot, 1);
+            }
+
+            // log the dispatch
+            if (logging) logging->event(current_cycle, EVENT_DISPATCHED, inst.tag);
+
+            // record dispatch and set schedule to next cycle (like reference)
+            // Note: reference sets schedule = cycle_count + 1 at dispatch time
+            entry.schedule_cycle = current_cycle + 1;
 
-                dispatched++;
+            // mark destination register as not ready
+            if (inst.dest_reg != -1) {
+                register_status[inst.dest_reg].ready = false;
+                register_status[inst.dest_reg].tag = inst.tag;
+                register_status[inst.dest_reg].slot = slot;
             }
         }
         reserved_slots = 0;
     }
 }
 
-uint64_t* get_counter(int32_t op_code) {
+uint32_t Core::take_free_slot() {
+    for (size_t w = 0; w < free_mask.size(); w++) {
+        if (free_mask[w] != 0) {
+            uint32_t bit = __builtin_ctzll(free_mask[w]);
+            free_mask[w] &= free_mask[w] - 1;
+            free_count--;
+            return (uint32_t)(w * 64 + bit);
+        }
+    }
+    return 0; // unreachable: callers check free_count
+}
+
+void Core::release_slot(uint32_t slot) {
+    free_mask[slot / 64] |= 1ULL << (slot % 64);
+    free_count++;
+}
+
+void Core::insert_ready(uint32_t slot) {
+    uint64_t tag = reservation_station[slot].instruction.tag;
+    ArenaVector<uint32_t>::iterator pos = ready_queue.end();
+    while (pos != ready_queue.begin() && reservation_station[*(pos - 1)].instruction.tag > tag) {
+        --pos;
+    }
+    ready_queue.insert(pos, slot);
+}
+
+void Core::add_dependent(uint32_t producer, uint32_t consumer, int src) {
+    uint32_t link = consumer * 2 + src;
+    dep_next[link] = dep_head[producer];
+    dep_head[producer] = link;
+}
+
+uint64_t* Core::get_counter(int32_t op_code) {
     int32_t fu_type = (op_code == -1) ? 1 : op_code;
     if (fu_type == 0) return &k0_counter;
     if (fu_type == 1) return &k1_counter;
@@ -282,7 +773,7 @@ uint64_t* get_counter(int32_t op_code) {
     return nullptr;
 }
 
-uint64_t get_fu_count(int32_t op_code) {
+uint64_t Core::get_fu_count(int32_t op_code) {
     int32_t fu_type = (op_code == -1) ? 1 : op_code;
     if (fu_type == 0) return K0_FU_COUNT;
     if (fu_type == 1) return K1_FU_COUNT;
@@ -290,85 +781,242 @@ uint64_t get_fu_count(int32_t op_code) {
     return 0;
 }
 
-void schedule_stage(bool firstHalf) {
-    if (firstHalf) {
-        // Try to fire instructions in RS (in tag order - map maintains order)
-        std::map<uint64_t, rs_entry_t*> ready_instructions;
-        for (auto& entry : reservation_station) {
-            if (!entry.valid || entry.fired) {
-                continue;
-            }
-            if (entry.src1_ready && entry.src2_ready) {
-                ready_instructions[entry.instruction.tag] = &entry;
-            }
-        }
+template <class Soa>
+bool Core::try_fire(uint32_t slot, Soa& soa) {
+    rs_entry_t* entry = &reservation_station[slot];
+    uint64_t* counter = get_counter(entry->instruction.op_code);
 
-        for (auto& pair : ready_instructions) {
-            rs_entry_t* entry = pair.second;
-            uint64_t* counter = get_counter(entry->instruction.op_code);
-            uint64_t fu_count = get_fu_count(entry->instruction.op_code);
+    // Check if there's a free FU slot
+    if (*counter >= get_fu_count(entry->instruction.op_code)) {
+        COUNT(count_blocked(slot));
+        return false;
+    }
 
-            // Check if there's a free FU slot
-            if (*counter < fu_count) {
-                // Reserve the FU
-                (*counter)++;
-                entry->fired = true;
-                instructions_fired++;
+    // Reserve the FU
+    (*counter)++;
+    entry->fired = true;
+    if (rs_layout == RS_LAYOUT_SOA) soa.fired[slot / 64] |= 1ULL << (slot % 64);
+    instructions_fired++;
 
-                fprintf(logging, "%llu\tSCHEDULED\t%llu\n", current_cycle, entry->instruction.tag + 1);
-                // Reference sets execute cycle to current + 1 when scheduled
-                instruction_cycles[entry->instruction.tag].execute = current_cycle + 1;
-            }
+    int type = fu_type(entry->instruction.op_code);
+    if (fu_timing.pipelined[type]) {
+        fu_issued[type]++;
+    }
+    wheel[(current_cycle + fu_timing.latency[type]) & wheel_mask].push_back(slot);
+    wheel_count++;
+
+    if (logging) logging->event(current_cycle, EVENT_SCHEDULED, entry->instruction.tag);
+    // Reference sets execute cycle to current + 1 when scheduled
+    entry->execute_cycle = current_cycle + 1;
+    return true;
+}
+
+// ready = in use, not fired, both sources ready; fired oldest tag first
+template <class Soa>
+void Core::select_soa(Soa& soa) {
+    scratch.clear();
+    for (size_t w = 0; w < soa.word_count(); w++) {
+        uint64_t ready = ~free_mask[w] & ~soa.fired[w] & soa.src_ready[0][w] & soa.src_ready[1][w];
+        while (ready != 0) {
+            scratch.push_back((uint32_t)(w * 64 + __builtin_ctzll(ready)));
+            ready &= ready - 1;
         }
-    } else {
-        // Wakeup instructions from CDB broadcast
-        for (auto& entry : reservation_station) {
-            if (!entry.valid || entry.fired) {
-                continue;
-            }
-            for (const auto& bus : result_buses) {
-                if (bus.busy) {
-                    if (!entry.src1_ready && entry.src1_parent == bus.tag) {
-                        entry.src1_ready = true;
-                    }
-                    if (!entry.src2_ready && entry.src2_parent == bus.tag) {
-                        entry.src2_ready = true;
+    }
+    std::sort(scratch.begin(), scratch.end(), [&soa](uint32_t a, uint32_t b) {
+        return soa.tag[a] < soa.tag[b];
+    });
+    for (uint32_t slot : scratch) {
+        try_fire(slot, soa);
+    }
+}
+
+// sets bit i % 64 of out[i / 64] for every parents[i] == tag; n is a
+// multiple of 4
+static void match_tags_scalar(const uint64_t* parents, size_t n, uint64_t tag, uint64_t* out)
+{
+    for (size_t w = 0; w * 64 < n; w++) {
+        size_t lanes = std::min(n - w * 64, (size_t)64);
+        uint64_t bits = 0;
+        for (size_t i = 0; i < lanes; i++) {
+            bits |= (uint64_t)(parents[w * 64 + i] == tag) << i;
+        }
+        out[w] = bits;
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void match_tags_avx2(const uint64_t* parents, size_t n, uint64_t tag, uint64_t* out)
+{
+    const __m256i needle = _mm256_set1_epi64x((long long)tag);
+    for (size_t w = 0; w * 64 < n; w++) {
+        size_t lanes = std::min(n - w * 64, (size_t)64);
+        uint64_t bits = 0;
+        for (size_t i = 0; i < lanes; i += 4) {
+            __m256i lanes = _mm256_loadu_si256((const __m256i*)&parents[w * 64 + i]);
+            __m256i eq = _mm256_cmpeq_epi64(lanes, needle);
+            bits |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << i;
+        }
+        out[w] = bits;
+    }
+}
+#endif
+
+static void match_tags(const uint64_t* parents, size_t n, uint64_t tag, uint64_t* out)
+{
+#if defined(__x86_64__)
+    static const bool have_avx2 = __builtin_cpu_supports("avx2");
+    if (have_avx2) {
+        match_tags_avx2(parents, n, tag, out);
+        return;
+    }
+#endif
+    match_tags_scalar(parents, n, tag, out);
+}
+
+void DynamicSoaRS::match(int src, size_t base, size_t chunk, uint64_t t, uint64_t* out) const
+{
+    match_tags(&parent[src][base * 64], chunk * 64, t, out);
+}
+
+template <size_t SLOTS>
+void FixedSoaRS<SLOTS>::match(int src, size_t base, size_t chunk, uint64_t t, uint64_t* out) const
+{
+    match_tags(&parent[src][base * 64], std::min(LANES - base * 64, chunk * 64), t, out);
+}
+
+// compare every waiting source against this cycle's broadcast tags
+template <class Soa>
+void Core::wakeup_soa(Soa& soa) {
+    size_t words = soa.word_count();
+    const size_t CHUNK_WORDS = 4;
+    uint64_t matched[2][CHUNK_WORDS];
+    for (uint32_t producer : wakeups) {
+        uint64_t tag = reservation_station[producer].instruction.tag;
+        for (size_t base = 0; base < words; base += CHUNK_WORDS) {
+            size_t chunk = std::min(words - base, CHUNK_WORDS);
+            soa.match(0, base, chunk, tag, matched[0]);
+            soa.match(1, base, chunk, tag, matched[1]);
+            for (size_t w = 0; w < chunk; w++) {
+                uint64_t waiting = ~free_mask[base + w] & ~soa.fired[base + w];
+                for (int i = 0; i < 2; i++) {
+                    uint64_t woken = matched[i][w] & waiting & ~soa.src_ready[i][base + w];
+                    soa.src_ready[i][base + w] |= woken;
+                    while (woken != 0) {
+                        rs_entry_t& entry = reservation_station[(base + w) * 64 + __builtin_ctzll(woken)];
+                        if (i == 0) entry.src1_ready = true; else entry.src2_ready = true;
+                        woken &= woken - 1;
                     }
                 }
             }
         }
     }
+    wakeups.clear();
+}
+
+void Core::schedule_stage(bool firstHalf) {
+    DynamicSoaRS soa = soa_view();
+    schedule_stage(firstHalf, soa);
 }
 
-void execute_stage(bool firstHalf) {
+template <class Soa>
+void Core::schedule_stage(bool firstHalf, Soa& soa) {
     if (firstHalf) {
-        // Collect executed instructions (in tag order)
-        std::map<uint64_t, std::pair<uint32_t, rs_entry_t*>> executed_this_cycle;
+        COUNT(blocked_count = 0; blocked_types = 0;)
+        if (rs_layout == RS_LAYOUT_SOA) {
+            select_soa(soa);
+        } else {
+            // Try to fire instructions in RS (the ready queue is kept in tag order)
+            size_t kept = 0;
+            for (size_t i = 0; i < ready_queue.size(); i++) {
+                uint32_t slot = ready_queue[i];
+                if (!try_fire(slot, soa)) {
+                    ready_queue[kept++] = slot;
+                }
+            }
+            ready_queue.resize(kept);
+        }
+        COUNT(
+            for (int t = 0; t < FU_TYPES; t++) {
+                if (blocked_types & (1u << t)) counters.fu_stall_cycles[t]++;
+            }
+            counters.ready_not_fired += blocked_count;
+        )
+    } else {
+        if (rs_layout == RS_LAYOUT_SOA) {
+            wakeup_soa(soa);
+            return;
+        }
 
-        for (auto& entry : reservation_station) {
-            if (entry.valid && entry.fired && !entry.completed) {
-                entry.completed = true;
-                entry.completed_cycle = current_cycle;
+        // Wakeup instructions from CDB broadcast: only the consumers
+        // indexed under this cycle's producers can be affected
+        for (uint32_t producer : wakeups) {
+            for (uint32_t link = dep_head[producer]; link != NO_DEP; link = dep_next[link]) {
+                uint32_t slot = link / 2;
+                rs_entry_t& entry = reservation_station[slot];
+                if (link % 2 == 0) {
+                    entry.src1_ready = true;
+                } else {
+                    entry.src2_ready = true;
+                }
+                if (entry.src1_ready && entry.src2_ready) {
+                    insert_ready(slot);
+                }
+            }
+            dep_head[producer] = NO_DEP;
+        }
+        wakeups.clear();
+    }
+}
 
-                fprintf(logging, "%llu\tEXECUTED\t%llu\n", current_cycle, entry.instruction.tag + 1);
+void Core::execute_stage(bool firstHalf) {
+    if (firstHalf) {
+        // Pipelined FUs are free again one cycle after issuing
+        for (int t = 0; t < FU_TYPES; t++) {
+            if (fu_issued[t] > 0) {
+                *get_counter(t) -= fu_issued[t];
+                fu_issued[t] = 0;
+            }
+        }
 
-                int32_t actual_op = (entry.instruction.op_code == -1) ? 1 : entry.instruction.op_code;
-                executed_this_cycle[entry.instruction.tag] = std::make_pair(actual_op, &entry);
+        // Finish everything due this cycle. A bucket is in tag order unless
+        // it mixes several fire cycles (different latencies).
+        ArenaVector<uint32_t>& done = wheel[current_cycle & wheel_mask];
+        if (logging) {
+            // the log lists them in RS order
+            scratch.assign(done.begin(), done.end());
+            std::sort(scratch.begin(), scratch.end());
+            for (uint32_t slot : scratch) {
+                logging->event(current_cycle, EVENT_EXECUTED, reservation_station[slot].instruction.tag);
             }
         }
+        if (done.size() > 1) {
+            std::sort(done.begin(), done.end(), [this](uint32_t a, uint32_t b) {
+                return reservation_station[a].instruction.tag < reservation_station[b].instruction.tag;
+            });
+        }
 
         // Add to waiting instructions queue
-        for (auto& pair : executed_this_cycle) {
-            completed_instructions.push_back(pair.second);
+        for (uint32_t slot : done) {
+            rs_entry_t& entry = reservation_station[slot];
+            entry.completed = true;
+            entry.completed_cycle = current_cycle;
+
+            completed_instructions.push(fu_type(entry.instruction.op_code), slot);
         }
+        wheel_count -= done.size();
+        done.clear();
+        if (completed_instructions.size() > bus_demand_peak) bus_demand_peak = completed_instructions.size();
+        COUNT(if (completed_instructions.size() > RESULT_BUSES) counters.bus_overflow_cycles++;)
 
         // Broadcast on result buses (oldest first)
-        auto w = completed_instructions.begin();
-        for (auto& bus : result_buses) {
-            if (w == completed_instructions.end()) break;
+        for (uint64_t b = 0; b < RESULT_BUSES; b++) {
+            if (completed_instructions.empty()) break;
 
-            uint32_t op_code = w->first;
-            rs_entry_t* entry = w->second;
+            ResultBus& bus = result_buses[b];
+            int op_code = next_bus_type();
+            uint32_t slot = completed_instructions.pop(op_code);
+            rs_entry_t* entry = &reservation_station[slot];
 
             bus.busy = true;
             bus.tag = entry->instruction.tag;
@@ -379,20 +1027,20 @@ void execute_stage(bool firstHalf) {
                 register_status[bus.reg].ready = true;
             }
 
-            // Free the FU
+            // Free the FU (a pipelined one was already released)
             uint64_t* counter;
             if (op_code == 0) counter = &k0_counter;
             else if (op_code == 1) counter = &k1_counter;
             else counter = &k2_counter;
 
-            if (*counter > 0) {
+            if (*counter > 0 && !fu_timing.pipelined[op_code]) {
                 (*counter)--;
             }
 
             entry->state_updated = true;
             entry->state_update_cycle = current_cycle;
-
-            w = completed_instructions.erase(w);
+            broadcast_now.push_back(slot);
+            wakeups.push_back(slot);
         }
 
         // Clear buses that weren't used this cycle
@@ -401,31 +1049,60 @@ void execute_stage(bool firstHalf) {
     // No second half actions
 }
 
-void state_update_stage(bool firstHalf) {
+void Core::state_update_stage(bool firstHalf) {
     if (!firstHalf) {
-        // Remove completed instructions from RS (completed in previous cycle)
-        for (auto& entry : reservation_station) {
-            if (entry.valid && entry.state_updated && entry.state_update_cycle < current_cycle) {
-                fprintf(logging, "%llu\tSTATE UPDATE\t%llu\n", current_cycle, entry.instruction.tag + 1);
-                instruction_cycles[entry.instruction.tag].state_update = current_cycle;
-
-                entry.valid = false;
-                entry.state_updated = false;
-                instructions_retired++;
+        // Remove instructions broadcast in the previous cycle from RS, in RS order
+        std::sort(retiring.begin(), retiring.end());
+        for (uint32_t slot : retiring) {
+            rs_entry_t& entry = reservation_station[slot];
+            if (logging) logging->event(current_cycle, EVENT_STATE_UPDATE, entry.instruction.tag);
+            if ((timing_rows && (output || timing_log)) || digest) {
+                InstructionCycles cycles = { entry.fetch_cycle, entry.dispatch_cycle, entry.schedule_cycle,
+                                             entry.execute_cycle, current_cycle };
+                if (timing_rows && (output || timing_log)) instruction_cycles.retire(entry.instruction.tag, cycles);
+                if (digest) digest->instruction(entry.instruction.tag, cycles);
             }
+
+            entry.valid = false;
+            entry.state_updated = false;
+            instructions_retired++;
+            release_slot(slot);
         }
+
+        // this cycle's broadcasts retire next cycle
+        retiring.swap(broadcast_now);
+        broadcast_now.clear();
     }
     // No first half actions
 }
 
-void fetch_stage() {
-    fetch_stage(false);  // Original only had second half
+int Core::next_bus_type() const
+{
+    if (bus_arbitration.policy == BUS_FU_PRIORITY) {
+        for (int i = 0; i < FU_TYPES; i++) {
+            if (!completed_instructions.empty(bus_arbitration.order[i])) return bus_arbitration.order[i];
+        }
+        return -1;
+    }
+
+    int best = -1;
+    for (int t = 0; t < FU_TYPES; t++) {
+        if (completed_instructions.empty(t)) continue;
+        if (best < 0) {
+            best = t;
+            continue;
+        }
+        const rs_entry_t& a = reservation_station[completed_instructions.front(t)];
+        const rs_entry_t& b = reservation_station[completed_instructions.front(best)];
+        if (a.completed_cycle < b.completed_cycle ||
+            (a.completed_cycle == b.completed_cycle && a.instruction.tag < b.instruction.tag)) {
+            best = t;
+        }
+    }
+    return best;
 }
 
-bool all_rs_empty() 
+bool Core::all_rs_empty() 
 {
-    for (const auto& entry : reservation_station) {
-        if (entry.valid) return false;
-    }
-    return true;
-}
\ No newline at end of file
+    return free_count == reservation_station.size();
+}
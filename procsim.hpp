@@ -1,9 +1,13 @@
 #ifndef PROCSIM_HPP
 #define PROCSIM_HPP
 
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <vector>
+#include "procsim_arena.hpp"
 
 #define DEFAULT_K0 1
 #define DEFAULT_K1 2
@@ -53,20 +57,767 @@ typedef struct _rs_entry_t {
     uint64_t fired_cycle;
 } rs_entry_t;
 
+// the running totals behind proc_stats_t, for measuring part of a run
+typedef struct _proc_counters_t
+{
+    uint64_t cycles;
+    uint64_t retired;
+    uint64_t fired;
+    uint64_t total_disp_size;   // dispatch queue size summed over cycles
+    uint64_t max_disp_size;
+} proc_counters_t;
+
+// host time spent in each stage, in nanoseconds
+typedef struct _stage_times_t
+{
+    uint64_t fetch;
+    uint64_t dispatch;
+    uint64_t schedule;
+    uint64_t execute;
+    uint64_t state_update;
+    uint64_t halves;        // timed half-cycles, each one clock read per stage
+} stage_times_t;
+
+// a look at a running core, taken between cycles
+typedef struct _progress_snapshot_t
+{
+    uint64_t cycle;
+    uint64_t retired;
+    double ipc;                 // retired / cycle so far
+    uint64_t dispatch_queue;
+    uint64_t rs_used;
+    uint64_t rs_size;
+    double host_seconds;        // since the previous snapshot (or the start)
+    double host_cycles_per_sec; // over that interval
+    double host_inst_per_sec;
+} progress_snapshot_t;
+
+// how often the free API's core reports progress: every `cycles` simulated
+// cycles, or if that is 0 every `seconds` of host time; to path, or stderr
+// if path is NULL
+typedef struct _progress_options_t
+{
+    uint64_t cycles;
+    double seconds;
+    const char* path;
+} progress_options_t;
+
+#define FU_TYPES 3
+#define DEFAULT_FU_LATENCY 1
+
+// execute timing per FU type (op code; -1 runs on k1)
+typedef struct _fu_timing_t
+{
+    uint64_t latency[FU_TYPES];     // cycles from firing to completion
+    bool pipelined[FU_TYPES];       // a unit accepts a new op every cycle
+} fu_timing_t;
+
+// how the RS tracks readiness: incremental ready queue plus a wakeup index
+// (the default), or structure-of-arrays bitmasks with SIMD tag matching
+typedef enum _rs_layout_t
+{
+    RS_LAYOUT_LISTS = 0,
+    RS_LAYOUT_SOA
+} rs_layout_t;
+
+// which completed instruction gets the next free result bus: the oldest by
+// completion cycle then tag (the default), or by FU type in a fixed order
+// with the oldest of each type first
+typedef enum _bus_policy_t
+{
+    BUS_OLDEST_FIRST = 0,
+    BUS_FU_PRIORITY
+} bus_policy_t;
+
+typedef struct _bus_arbitration_t
+{
+    bus_policy_t policy;
+    int order[FU_TYPES];        // BUS_FU_PRIORITY: FU types, highest priority first
+} bus_arbitration_t;
+
+// how much a run writes: nothing, the output file's settings and stats
+// blocks, or everything including the event log and per-instruction timing
+typedef enum _log_level_t
+{
+    LOG_OFF = 0,
+    LOG_STATS,
+    LOG_EVENTS
+} log_level_t;
+
+typedef struct _output_options_t
+{
+    log_level_t level;
+    const char* output_path;    // settings, timing table and stats
+    const char* log_path;       // pipeline event log
+    bool binary_log;            // fixed-size records instead of text
+    bool extended_stats;        // add the pipeline counters after the stats
+    const char* json_path;      // stats and counters as JSON, or NULL
+    const char* timing_path;    // the timing table in binary columns instead, or NULL
+} output_options_t;
+
 bool read_instruction(proc_inst_t* p_inst);
+// reads up to n instructions, fewer only once the trace is exhausted
+size_t read_instructions(proc_inst_t* buf, size_t n);
 
 void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f);
 void run_proc(proc_stats_t* p_stats);
 void complete_proc(proc_stats_t *p_stats);
 
-// Stage functions
-void fetch_stage(bool firstHalf);
-void dispatch_stage(bool firstHalf);
-void schedule_stage(bool firstHalf);
-void execute_stage(bool firstHalf);
-void state_update_stage(bool firstHalf);
+// FU latencies for the next setup_proc; every type defaults to one cycle, unpipelined
+void set_fu_timing(const fu_timing_t* timing);
+
+// RS implementation for the next setup_proc (results are identical)
+void set_rs_layout(rs_layout_t layout);
+
+// result bus arbitration for the next setup_proc; oldest-first by default
+void set_bus_arbitration(const bus_arbitration_t* arbitration);
+
+// dispatch queue capacity for the next setup_proc; 0 (the default) is unbounded
+void set_dispatch_limit(uint64_t limit);
+
+// progress lines while run_proc runs, from the next setup_proc on; NULL
+// (the default) or zero intervals turn them off
+void set_progress(const progress_options_t* options);
+
+// what the free API's core does with its run digest (see RunDigest): with
+// verify, compare against the golden digest at path; otherwise record one
+// there, marked every interval cycles (0 for DIGEST_INTERVAL)
+typedef struct _digest_options_t
+{
+    const char* path;
+    bool verify;
+    uint64_t interval;
+} digest_options_t;
+
+// takes effect from the next setup_proc; NULL turns the digest off. Returns
+// false if a golden digest cannot be read.
+bool set_digest(const digest_options_t* options);
+// after complete_proc, saves the digest or reports the comparison on
+// stderr; false if saving failed or the run diverged from the golden
+bool finish_digest(void);
+
+// run_proc in steps: runs through cycle `cycle`, false once the trace is done
+// or the pipeline has deadlocked
+bool run_proc_until(uint64_t cycle);
+// whether the last run stopped because no instruction could ever make
+// progress again (an op type with no FUs); its stats are then meaningless
+bool proc_deadlocked(void);
+// skips n instructions untimed before run_proc (see Core::warm)
+uint64_t warm_proc(uint64_t n);
+// the default core's state; restore_checkpoint replaces setup_proc
+bool save_checkpoint(const char* path);
+bool restore_checkpoint(const char* path);
+
+// where setup_proc sends its files; defaults to log.txt and output.output
+// with every event and no extended stats or JSON. Must be called before the
+// first setup_proc.
+void set_output_options(const output_options_t* options);
+
+namespace procsim {
+
+class EventLog;
+class ColumnarTimingLog;
+class RunDigest;
+
+// whether the stages can index inst's op code (-1..FU_TYPES-1) and
+// registers (-1 or below Core::NUM_REGISTERS); sources and checkpoints
+// check every instruction they hand over
+inline bool valid_instruction(const proc_inst_t& inst);
+
+// where fetch_stage pulls instructions from
+class InstructionSource {
+public:
+    virtual ~InstructionSource() {}
+    // returns true if an instruction was read successfully
+    virtual bool read(proc_inst_t* p_inst) = 0;
+    // reads up to n instructions, fewer only once the source is exhausted
+    virtual size_t read(proc_inst_t* buf, size_t n) {
+        size_t got = 0;
+        while (got < n && read(&buf[got])) got++;
+        return got;
+    }
+    // discards up to n instructions, fewer only once the source is exhausted
+    virtual uint64_t skip(uint64_t n) {
+        proc_inst_t buf[256];
+        uint64_t skipped = 0;
+        while (skipped < n) {
+            size_t want = (n - skipped < 256) ? (size_t)(n - skipped) : 256;
+            size_t got = read(buf, want);
+            skipped += got;
+            if (got < want) break;
+        }
+        return skipped;
+    }
+};
+
+// reads through the driver's read_instruction()
+class ReadInstructionSource : public InstructionSource {
+public:
+    bool read(proc_inst_t* p_inst) { return read_instruction(p_inst); }
+    size_t read(proc_inst_t* buf, size_t n) { return read_instructions(buf, n); }
+};
+
+// replays a trace that was parsed up front; the array is shared and never written
+class ArraySource : public InstructionSource {
+public:
+    ArraySource(const proc_inst_t* insts, size_t count) : insts(insts), count(count), pos(0) {}
+    bool read(proc_inst_t* p_inst) {
+        if (pos == count) return false;
+        *p_inst = insts[pos++];
+        return true;
+    }
+    size_t read(proc_inst_t* buf, size_t n) {
+        if (n > count - pos) n = count - pos;
+        memcpy(buf, insts + pos, n * sizeof(proc_inst_t));
+        pos += n;
+        return n;
+    }
+    uint64_t skip(uint64_t n) {
+        if (n > count - pos) n = count - pos;
+        pos += n;
+        return n;
+    }
+private:
+    const proc_inst_t* insts;
+    size_t count;
+    size_t pos;
+};
+
+// Why a run is slow, sampled at fixed points of every cycle (skipped idle
+// cycles included). Build with PROCSIM_NO_COUNTERS to compile the sampling out.
+struct PipelineCounters {
+    uint64_t dispatch_stall_cycles;     // instructions left queued because the RS was full
+    uint64_t fu_stall_cycles[FU_TYPES]; // a ready op of this FU type found every unit busy
+    uint64_t bus_overflow_cycles;       // more completed instructions than result buses
+    uint64_t ready_not_fired;           // ready ops left unfired, summed over cycles
+    std::vector<uint64_t> rs_occupancy; // cycles spent with n RS entries in use, by n
+};
+
+// receives each run's configuration and final stats from complete_proc,
+// alongside (or instead of) the output file
+class StatsSink {
+public:
+    virtual ~StatsSink() {}
+    virtual void report(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f,
+                        const proc_stats_t& stats) = 0;
+};
+
+// receives progress_snapshot_t while a run is in progress
+class ProgressSink {
+public:
+    virtual ~ProgressSink() {}
+    virtual void snapshot(const progress_snapshot_t& snapshot) = 0;
+};
+
+// one key=value line per snapshot, flushed so a tail -f shows it at once
+class TextProgressSink : public ProgressSink {
+public:
+    explicit TextProgressSink(FILE* out) : out(out) {}
+    void snapshot(const progress_snapshot_t& snapshot);
+private:
+    FILE* out;
+};
+
+// a fetched instruction waiting for dispatch
+struct QueuedInstruction {
+    proc_inst_t inst;
+    uint64_t fetch_cycle;
+};
+
+// FIFO of instructions in a power-of-two ring; grows only when full, so a
+// queue that has reached its working size (or was reserved up front) never
+// allocates again
+class InstructionQueue {
+public:
+    InstructionQueue() : mask(0), head(0), count(0) {}
+
+    // empties the queue and takes all further storage from arena
+    void attach(Arena* arena) {
+        arena_attach(slots, arena);
+        mask = 0;
+        clear();
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    void clear() { head = 0; count = 0; }
+    void reserve(size_t n) {
+        while (slots.size() < n) grow();
+    }
+
+    QueuedInstruction& front() { return slots[head]; }
+    const QueuedInstruction& at(size_t i) const { return slots[(head + i) & mask]; }
+    void pop_front() {
+        head = (head + 1) & mask;
+        count--;
+    }
+    void push_back(const proc_inst_t& inst, uint64_t fetch_cycle) {
+        if (count == slots.size()) grow();
+        QueuedInstruction& q = slots[(head + count) & mask];
+        q.inst = inst;
+        q.fetch_cycle = fetch_cycle;
+        count++;
+    }
+
+private:
+    void grow() {
+        ArenaVector<QueuedInstruction> bigger(slots.empty() ? 64 : slots.size() * 2, QueuedInstruction(),
+                                              slots.get_allocator());
+        for (size_t i = 0; i < count; i++) {
+            bigger[i] = slots[(head + i) & mask];
+        }
+        slots.swap(bigger);
+        mask = slots.size() - 1;
+        head = 0;
+    }
+
+    ArenaVector<QueuedInstruction> slots;
+    size_t mask;
+    size_t head;
+    size_t count;
+};
+
+// Completed instructions waiting for a result bus, as RS slots in one ring
+// per FU type. Each ring is in (completion cycle, tag) order because a
+// cycle's completions arrive sorted by tag, so whatever the policy only the
+// heads are ever compared. Rings are sized once and never grow: an entry
+// holds its RS slot until it has been broadcast.
+class CompletionQueue {
+public:
+    CompletionQueue() : mask(0), total(0) {
+        for (int t = 0; t < FU_TYPES; t++) head[t] = count[t] = 0;
+    }
+
+    // room for `capacity` entries in every ring, from arena
+    void reset(size_t capacity, Arena* arena) {
+        size_t size = 1;
+        while (size < capacity) size *= 2;
+        for (int t = 0; t < FU_TYPES; t++) {
+            arena_attach(slots[t], arena);
+            slots[t].resize(size);
+            head[t] = count[t] = 0;
+        }
+        mask = size - 1;
+        total = 0;
+    }
+
+    bool empty() const { return total == 0; }
+    size_t size() const { return total; }
+    bool empty(int type) const { return count[type] == 0; }
+    size_t size(int type) const { return count[type]; }
+    uint32_t at(int type, size_t i) const { return slots[type][(head[type] + i) & mask]; }
+    uint32_t front(int type) const { return slots[type][head[type]]; }
+
+    void push(int type, uint32_t slot) {
+        slots[type][(head[type] + count[type]) & mask] = slot;
+        count[type]++;
+        total++;
+    }
+    uint32_t pop(int type) {
+        uint32_t slot = slots[type][head[type]];
+        head[type] = (head[type] + 1) & mask;
+        count[type]--;
+        total--;
+        return slot;
+    }
+
+private:
+    ArenaVector<uint32_t> slots[FU_TYPES];
+    size_t head[FU_TYPES];
+    size_t count[FU_TYPES];
+    size_t mask;
+    size_t total;
+};
+
+// result bus structure (matching reference)
+struct ResultBus {
+    bool busy;
+    uint64_t tag;
+    int32_t reg;
+};
+
+// the latest dispatched writer to this register, and whether the register is ready
+struct RegisterStatus {
+    uint64_t tag;
+    bool ready;
+    uint32_t slot;  // RS slot of that writer while it is not ready
+};
+
+// Track instruction cycle info for output
+struct InstructionCycles {
+    uint64_t fetch;
+    uint64_t dispatch;
+    uint64_t schedule;
+    uint64_t execute;
+    uint64_t state_update;
+};
+
+// Reorder window for the INST/FETCH/DISP/SCHED/EXEC/STATE table. Rows arrive
+// as instructions retire, in any order, and are written in tag order as soon
+// as every older tag has retired, so only the in-flight span is held.
+class TimingWindow {
+public:
+    TimingWindow() : output(NULL), columnar(NULL), base(0), mask(0) {}
+
+    // starts a new table, written to columnar if given, else as text to
+    // output; the window then grows inside arena
+    void reset(FILE* output, ColumnarTimingLog* columnar, Arena* arena);
+    void retire(uint64_t tag, const InstructionCycles& cycles);
+
+    // the oldest tag not yet written, and the newer rows already retired
+    uint64_t next_tag() const { return base; }
+    void pending(std::vector<std::pair<uint64_t, InstructionCycles> >& out) const;
+    // tags below tag will never retire here; only valid with nothing pending
+    void skip_to(uint64_t tag) { base = tag; }
+
+private:
+    void grow(uint64_t span);
+
+    FILE* output;
+    ColumnarTimingLog* columnar;
+    uint64_t base;      // oldest tag not yet written
+    size_t mask;
+    ArenaVector<InstructionCycles> rows;
+    ArenaVector<bool> done;
+};
+
+// The SoA reservation station as the SoA stages see it: each slot's tag and
+// parent tags, and per 64-slot word the source-ready and fired bitmasks.
+// DynamicSoaRS points into the core's arena vectors, which are padded to
+// whole words; FixedSoaRS holds SLOTS slots padded only to a whole SIMD
+// compare (4 slots), so every walk over it has a trip count known at compile
+// time. Both offer the same members.
+struct DynamicSoaRS {
+    size_t words;
+    uint64_t* tag;
+    uint64_t* parent[2];
+    uint64_t* src_ready[2];
+    uint64_t* fired;
+
+    size_t word_count() const { return words; }
+    // bit i of out[w] = (parent[src][(base + w) * 64 + i] == t), for chunk words
+    void match(int src, size_t base, size_t chunk, uint64_t t, uint64_t* out) const;
+};
+
+template <size_t SLOTS>
+struct FixedSoaRS {
+    static const size_t WORDS = (SLOTS + 63) / 64;
+    static const size_t LANES = (SLOTS + 3) / 4 * 4;
+    std::array<uint64_t, SLOTS> tag;
+    std::array<uint64_t, LANES> parent[2];
+    std::array<uint64_t, WORDS> src_ready[2];
+    std::array<uint64_t, WORDS> fired;
+
+    // padding slots never match a broadcast tag
+    FixedSoaRS() {
+        parent[0].fill(UINT64_MAX);
+        parent[1].fill(UINT64_MAX);
+    }
+
+    size_t word_count() const { return WORDS; }
+    // as DynamicSoaRS::match
+    void match(int src, size_t base, size_t chunk, uint64_t t, uint64_t* out) const;
+    // copies in from, and back out to, a view of the same RS size
+    void load(const DynamicSoaRS& from) {
+        for (size_t i = 0; i < SLOTS; i++) {
+            tag[i] = from.tag[i];
+            parent[0][i] = from.parent[0][i];
+            parent[1][i] = from.parent[1][i];
+        }
+        for (size_t w = 0; w < WORDS; w++) {
+            src_ready[0][w] = from.src_ready[0][w];
+            src_ready[1][w] = from.src_ready[1][w];
+            fired[w] = from.fired[w];
+        }
+    }
+    void store(const DynamicSoaRS& to) const {
+        for (size_t i = 0; i < SLOTS; i++) {
+            to.tag[i] = tag[i];
+            to.parent[0][i] = parent[0][i];
+            to.parent[1][i] = parent[1][i];
+        }
+        for (size_t w = 0; w < WORDS; w++) {
+            to.src_ready[0][w] = src_ready[0][w];
+            to.src_ready[1][w] = src_ready[1][w];
+            to.fired[w] = fired[w];
+        }
+    }
+};
+
+// Machine shapes (R, k0, k1, k2, F) whose -A soa runs keep the SoA arrays in
+// Simulator<...>::Soa, a FixedSoaRS on the stack, for the length of each
+// run_until. Only k0 + k1 + k2 sizes that storage; R and F complete the
+// shape as -S names it. Every other shape, and the lists layout, use the
+// arena arrays directly. Results are the same either way.
+#define PROCSIM_FIXED_SHAPES(X) \
+    X(8, 1, 2, 3, 4)            \
+    X(2, 3, 2, 1, 4)            \
+    X(4, 2, 2, 2, 4)            \
+    X(8, 4, 4, 4, 8)
+
+template <uint64_t R, uint64_t K0, uint64_t K1, uint64_t K2, uint64_t F>
+struct Simulator {
+    static const size_t RS_SIZE = 2 * (K0 + K1 + K2);
+    typedef FixedSoaRS<RS_SIZE> Soa;
+
+    static bool matches(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f) {
+        return r == R && k0 == K0 && k1 == K1 && k2 == K2 && f == F;
+    }
+};
+
+// One simulated processor. All per-run state lives here so several cores can
+// run side by side; logging/output may be NULL to skip writing them, and
+// level turns them down further (LOG_STATS keeps only the output file's
+// settings and stats). A core shares nothing with other cores, so each thread
+// may drive its own.
+class Core {
+public:
+    static const int32_t NUM_REGISTERS = 128;
+    static const uint64_t NO_EVENT = UINT64_MAX;
+    static const uint64_t PROGRESS_POLL_CYCLES = 4096;
+
+    Core(InstructionSource* source, EventLog* logging, FILE* output, log_level_t level = LOG_EVENTS);
+
+    // takes effect at the next setup_proc
+    void set_fu_timing(const fu_timing_t& timing);
+    void set_rs_layout(rs_layout_t layout) { rs_layout = layout; }
+    void set_bus_arbitration(const bus_arbitration_t& arbitration) { bus_arbitration = arbitration; }
+    // a full dispatch queue holds fetch back; 0 leaves it unbounded
+    void set_dispatch_limit(uint64_t limit) { dispatch_limit = limit; }
+    // may be changed between runs; the core never owns source or sink
+    void set_source(InstructionSource* next) { source = next; }
+    void set_stats_sink(StatsSink* sink) { stats_sink = sink; }
+    // adds each stage's host time to times while running; NULL (the default)
+    // leaves the cycle loop untimed
+    void set_stage_times(stage_times_t* times) { stage_times = times; }
+    // sends a snapshot to sink every `cycles` simulated cycles, or if that
+    // is 0 every `seconds` of host time (the clock is read only every
+    // PROGRESS_POLL_CYCLES cycles). The core never owns sink; NULL (the
+    // default) turns snapshots off.
+    void set_progress(ProgressSink* sink, uint64_t cycles, double seconds);
+    // also write the counter block after the output file's stats
+    void set_extended_stats(bool enable) { extended_stats = enable; }
+    // at LOG_EVENTS, send the timing table to log instead of the output
+    // file; takes effect at the next setup_proc
+    void set_timing_log(ColumnarTimingLog* log) { timing_log = log; }
+    // fold every retired row and cycle into digest (not owned; NULL, the
+    // default, turns it off); each setup_proc begins it again and
+    // complete_proc finishes it
+    void set_digest(RunDigest* d) { digest = d; }
+
+    const PipelineCounters& pipeline_counters() const { return counters; }
+    // the counter block as text, and everything from complete_proc as JSON
+    void print_counters(FILE* out) const;
+    void print_json(FILE* out, const proc_stats_t& stats) const;
+
+    void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f);
+    void run_proc();
+    void complete_proc(proc_stats_t *p_stats);
+    // starts another run with the last setup_proc configuration, reusing
+    // every buffer already sized for it
+    void reset();
+    // runs until the end of cycle `cycle` (or the trace); false once done or
+    // deadlocked
+    bool run_until(uint64_t cycle);
+    // the run stopped short because nothing in flight could ever progress;
+    // cleared by setup_proc
+    bool deadlocked() const { return deadlock; }
+    void read_counters(proc_counters_t* counters) const;
+
+    // Functional warming: consumes up to n instructions without timing them,
+    // keeping tags and the trace offset as if they had run. The model has no
+    // history beyond in-flight instructions, so this needs an empty machine
+    // and leaves it empty. Returns the number skipped.
+    uint64_t warm(uint64_t n);
+
+    // The complete machine state at a cycle boundary, with the configuration
+    // and trace offset. restore_checkpoint acts as setup_proc with the saved
+    // configuration, then skips the saved offset from a source positioned at
+    // the start of the same trace.
+    bool save_checkpoint(FILE* out);
+    bool restore_checkpoint(FILE* in);
+
+    // Copies from's complete machine state and configuration, as a checkpoint
+    // would, except that this core gets r result buses. Buffers are copied
+    // into this core's arena, so the two run on independently. The source is
+    // left alone: give this core one already at from's trace_offset(). Only
+    // for cores with no event log or output file.
+    void fork(const Core& from, uint64_t r);
+    // instructions taken from the source so far
+    uint64_t trace_offset() const { return global_tag_counter; }
+    // The most completed instructions that have competed for the result
+    // buses in one cycle of this run. Until it exceeds some smaller R, a core
+    // with R buses would have behaved exactly the same.
+    uint64_t peak_bus_demand() const { return bus_demand_peak; }
+
+    // Stage functions
+    void fetch_stage(bool firstHalf);
+    void dispatch_stage(bool firstHalf);
+    void schedule_stage(bool firstHalf);
+    void execute_stage(bool firstHalf);
+    void state_update_stage(bool firstHalf);
+
+    // Utility functions
+    bool all_rs_empty();
+    // system allocations made for per-run state so far
+    uint64_t arena_allocations() const { return arena.system_allocations(); }
+
+private:
+    uint64_t* get_counter(int32_t op_code);
+    uint64_t get_fu_count(int32_t op_code);
+    static int fu_type(int32_t op_code) { return (op_code == -1) ? 1 : op_code; }
+    // The cycle loop and everything in it that touches the SoA arrays take
+    // them as soa: a DynamicSoaRS view, or a FixedSoaRS for the shapes in
+    // PROCSIM_FIXED_SHAPES
+    void run_cycles(uint64_t stop_cycle);
+    template <class Soa> void run_fixed(uint64_t stop_cycle);
+    template <class Soa> void run_cycles(uint64_t stop_cycle, Soa& soa);
+    template <class Soa> void run_timed_half(bool firstHalf, Soa& soa);
+    template <class Soa> void dispatch_stage(bool firstHalf, Soa& soa);
+    template <class Soa> void schedule_stage(bool firstHalf, Soa& soa);
+    DynamicSoaRS soa_view();
+    // the next cycle in which any stage can change state, or NO_EVENT
+    template <class Soa> uint64_t next_event_cycle(Soa& soa);
+    template <class Soa> void skip_idle_cycles(uint64_t cycles, Soa& soa);
+    // sends a snapshot if one is due, and picks the cycle to check again at
+    void poll_progress();
+    void count_blocked(uint32_t slot);
+    // the FU type whose head gets the next result bus
+    int next_bus_type() const;
+    uint32_t take_free_slot();
+    void release_slot(uint32_t slot);
+    void insert_ready(uint32_t slot);
+    void add_dependent(uint32_t producer, uint32_t consumer, int src);
+    template <class Soa> bool try_fire(uint32_t slot, Soa& soa);
+    template <class Soa> void select_soa(Soa& soa);
+    template <class Soa> void wakeup_soa(Soa& soa);
+
+    // every per-run buffer lives here; setup_proc resets it
+    Arena arena;
+
+    InstructionSource* source;
+    StatsSink* stats_sink;
+    stage_times_t* stage_times;
+    ProgressSink* progress_sink;
+    uint64_t progress_cycles;
+    double progress_seconds;
+    // where the current interval started; unanchored until the first poll
+    // of a run, so a restored core measures from its own first cycle
+    bool progress_anchored;
+    uint64_t progress_next;             // cycle of the next poll
+    uint64_t progress_last_cycle;
+    uint64_t progress_last_retired;
+    std::chrono::steady_clock::time_point progress_last_time;
+    EventLog* logging;
+    FILE* output;
+    ColumnarTimingLog* timing_log;
+    RunDigest* digest;
+    bool timing_rows;
+    bool extended_stats;
+
+    // processor states
+    uint64_t RESULT_BUSES;
+    uint64_t K0_FU_COUNT;
+    uint64_t K1_FU_COUNT;
+    uint64_t K2_FU_COUNT;
+    uint64_t FETCH_RATE;
+
+    // one fetch group, filled by a single source read
+    ArenaVector<proc_inst_t> fetch_buffer;
+
+    // dispatch queue, preallocated when dispatch_limit bounds it
+    InstructionQueue dispatch_queue;
+    uint64_t dispatch_limit;
+    // reserved slots (for dispatching to RS)
+    uint64_t reserved_slots;
+
+    // reservation station
+    ArenaVector<rs_entry_t> reservation_station;
+
+    // RS activity, kept up to date as entries change state so no stage has
+    // to walk the whole reservation station. All hold RS slot indices.
+    ArenaVector<uint64_t> free_mask;       // bit set = slot free
+    uint64_t free_count;
+    ArenaVector<uint32_t> ready_queue;     // sources ready, not fired; tag order
+    ArenaVector<uint32_t> broadcast_now;   // broadcast this cycle
+    ArenaVector<uint32_t> retiring;        // broadcast last cycle, retire this cycle
+    ArenaVector<uint32_t> scratch;
+
+    // RS_LAYOUT_SOA: the hot RS fields as arrays padded to whole 64-slot
+    // words, and per-word bitmasks (bit set = source ready / entry fired).
+    // Ready to fire = ~free_mask & ~fired_mask & src_ready_mask[0] & [1].
+    // Only kept up to date under that layout; the lists never read them.
+    // Fixed-shape runs work on a copy and write it back as run_until returns.
+    rs_layout_t rs_layout;
+    ArenaVector<uint64_t> soa_tag;
+    ArenaVector<uint64_t> soa_parent[2];
+    ArenaVector<uint64_t> src_ready_mask[2];
+    ArenaVector<uint64_t> fired_mask;
+
+    // Wakeup index: the consumers still waiting on each producer slot, as a
+    // linked list of (consumer slot * 2 + source) links, filled at dispatch
+    static const uint32_t NO_DEP = UINT32_MAX;
+    ArenaVector<uint32_t> dep_head;        // per producer slot
+    ArenaVector<uint32_t> dep_next;        // per consumer slot * 2 + source
+    ArenaVector<uint32_t> wakeups;         // producer slots broadcast this cycle
+
+    ArenaVector<ResultBus> result_buses;
+
+    // instructions completed and waiting for a result bus
+    CompletionQueue completed_instructions;
+    bus_arbitration_t bus_arbitration;
+
+    // register ready table
+    RegisterStatus register_status[NUM_REGISTERS];
+
+    // FU counters: tracks how many FUs are currently in use
+    uint64_t k0_counter;
+    uint64_t k1_counter;
+    uint64_t k2_counter;
+
+    // FU execute timing. An unpipelined FU is held from firing until its
+    // result is broadcast; a pipelined one only for the cycle it issues in.
+    fu_timing_t fu_timing;
+    uint64_t fu_issued[FU_TYPES];          // pipelined issues to release next cycle
+
+    // Timing wheel of fired instructions, bucketed by completion cycle
+    // (cycle & wheel_mask). The wheel spans more than the longest latency.
+    ArenaVector<ArenaVector<uint32_t> > wheel;
+    uint64_t wheel_mask;
+    uint64_t wheel_count;
+
+    // counters
+    uint64_t global_tag_counter;
+    uint64_t current_cycle;
+
+    // statistics tracking
+    uint64_t max_disp_size;
+    uint64_t total_disp_size;
+    uint64_t instructions_fired;
+    uint64_t instructions_retired;
+    bool done_fetching;
+    uint64_t bus_demand_peak;
+    bool deadlock;
+
+    // per-instruction timing, streamed to the output file as it retires
+    TimingWindow instruction_cycles;
+
+    PipelineCounters counters;
+    // ready ops try_fire turned away in this cycle's schedule stage
+    uint64_t blocked_count;
+    unsigned blocked_types;                // bit per FU type
+};
+
+inline bool valid_instruction(const proc_inst_t& inst)
+{
+    if (inst.op_code < -1 || inst.op_code >= FU_TYPES) return false;
+    if (inst.dest_reg < -1 || inst.dest_reg >= Core::NUM_REGISTERS) return false;
+    for (int i = 0; i < 2; i++) {
+        if (inst.src_reg[i] < -1 || inst.src_reg[i] >= Core::NUM_REGISTERS) return false;
+    }
+    return true;
+}
 
-// Utility functions
-bool all_rs_empty();
+} // namespace procsim
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,239 @@
+#include "procsim_analyze.hpp"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+
+using namespace procsim;
+
+static const int ANALYSIS_VERSION = 2;
+
+static bool valid_reg(int32_t reg)
+{
+    return reg >= 0 && reg < Core::NUM_REGISTERS;
+}
+
+static int distance_bucket(uint64_t distance)
+{
+    int bucket = 63 - __builtin_clzll(distance);
+    return std::min(bucket, ANALYSIS_DISTANCE_BUCKETS - 1);
+}
+
+void analyze_trace(const std::vector<proc_inst_t>& trace, trace_analysis_t* p_analysis)
+{
+    memset(p_analysis, 0, sizeof(trace_analysis_t));
+    p_analysis->instructions = trace.size();
+
+    // per register: 1 + index of its last writer (0 = none), and the chain
+    // depth of the value it holds
+    uint64_t writer[Core::NUM_REGISTERS] = {};
+    uint64_t depth[Core::NUM_REGISTERS] = {};
+
+    for (uint64_t i = 0; i < trace.size(); i++) {
+        const proc_inst_t& inst = trace[i];
+        int32_t fu_type = (inst.op_code == -1) ? 1 : inst.op_code;
+        if (fu_type >= 0 && fu_type < FU_TYPES) p_analysis->op_mix[fu_type]++;
+
+        uint64_t longest = 0;
+        for (int s = 0; s < 2; s++) {
+            int32_t reg = inst.src_reg[s];
+            if (!valid_reg(reg)) continue;
+            p_analysis->operands++;
+            if (writer[reg] == 0) {
+                p_analysis->live_in++;
+                continue;
+            }
+            uint64_t distance = i + 1 - writer[reg];
+            p_analysis->distance_sum += distance;
+            p_analysis->distance[distance_bucket(distance)]++;
+            longest = std::max(longest, depth[reg]);
+        }
+
+        if (valid_reg(inst.dest_reg)) {
+            writer[inst.dest_reg] = i + 1;
+            depth[inst.dest_reg] = longest + 1;
+        }
+        p_analysis->critical_path = std::max(p_analysis->critical_path, longest + 1);
+    }
+}
+
+double ideal_ilp(const trace_analysis_t& analysis)
+{
+    if (analysis.critical_path == 0) return 0.0;
+    return (double)analysis.instructions / (double)analysis.critical_path;
+}
+
+void print_analysis(FILE* out, const trace_analysis_t& analysis)
+{
+    uint64_t n = std::max(analysis.instructions, (uint64_t)1);
+    uint64_t dependent = analysis.operands - analysis.live_in;
+
+    fprintf(out, "Instructions: %llu\n", (unsigned long long)analysis.instructions);
+    for (int t = 0; t < FU_TYPES; t++) {
+        fprintf(out, "k%d: %llu (%.1f%%)\n", t, (unsigned long long)analysis.op_mix[t],
+                100.0 * analysis.op_mix[t] / n);
+    }
+    fprintf(out, "Source operands: %llu, %llu with no producer in the trace\n",
+            (unsigned long long)analysis.operands, (unsigned long long)analysis.live_in);
+    fprintf(out, "Avg dependency distance: %f\n",
+            dependent ? (double)analysis.distance_sum / (double)dependent : 0.0);
+    fprintf(out, "DISTANCE\tOPERANDS\n");
+    for (int b = 0; b < ANALYSIS_DISTANCE_BUCKETS; b++) {
+        if (b == ANALYSIS_DISTANCE_BUCKETS - 1) {
+            fprintf(out, "%llu+", 1ULL << b);
+        } else if (b == 0) {
+            fprintf(out, "1");
+        } else {
+            fprintf(out, "%llu-%llu", 1ULL << b, (2ULL << b) - 1);
+        }
+        fprintf(out, "\t%llu\n", (unsigned long long)analysis.distance[b]);
+    }
+    fprintf(out, "Critical path (instructions): %llu\n", (unsigned long long)analysis.critical_path);
+    fprintf(out, "Ideal ILP: %f\n", ideal_ilp(analysis));
+}
+
+static std::string sidecar_path(const char* trace_path)
+{
+    return std::string(trace_path) + ".analysis";
+}
+
+bool load_analysis(const char* trace_path, trace_analysis_t* p_analysis)
+{
+    struct stat st;
+    if (stat(trace_path, &st) != 0) return false;
+    FILE* file = fopen(sidecar_path(trace_path).c_str(), "r");
+    if (file == NULL) return false;
+
+    int version = 0;
+    unsigned long long size = 0, mtime = 0, mtime_nsec = 0;
+    unsigned long long v[6 + FU_TYPES + ANALYSIS_DISTANCE_BUCKETS];
+    // nanoseconds too, so a rewrite within the same second is still caught
+    bool ok = fscanf(file, "procsim-analysis %d trace_size %llu trace_mtime %llu.%llu",
+                     &version, &size, &mtime, &mtime_nsec) == 4 &&
+              version == ANALYSIS_VERSION && size == (unsigned long long)st.st_size &&
+              mtime == (unsigned long long)st.st_mtim.tv_sec && mtime_nsec == (unsigned long long)st.st_mtim.tv_nsec;
+    ok = ok && fscanf(file, " instructions %llu op_mix", &v[0]) == 1;
+    for (int t = 0; ok && t < FU_TYPES; t++) ok = fscanf(file, "%llu", &v[1 + t]) == 1;
+    ok = ok && fscanf(file, " operands %llu live_in %llu distance_sum %llu distance",
+                      &v[1 + FU_TYPES], &v[2 + FU_TYPES], &v[3 + FU_TYPES]) == 3;
+    for (int b = 0; ok && b < ANALYSIS_DISTANCE_BUCKETS; b++) ok = fscanf(file, "%llu", &v[4 + FU_TYPES + b]) == 1;
+    ok = ok && fscanf(file, " critical_path %llu", &v[4 + FU_TYPES + ANALYSIS_DISTANCE_BUCKETS]) == 1;
+    fclose(file);
+    if (!ok) return false;
+
+    p_analysis->instructions = v[0];
+    for (int t = 0; t < FU_TYPES; t++) p_analysis->op_mix[t] = v[1 + t];
+    p_analysis->operands = v[1 + FU_TYPES];
+    p_analysis->live_in = v[2 + FU_TYPES];
+    p_analysis->distance_sum = v[3 + FU_TYPES];
+    for (int b = 0; b < ANALYSIS_DISTANCE_BUCKETS; b++) p_analysis->distance[b] = v[4 + FU_TYPES + b];
+    p_analysis->critical_path = v[4 + FU_TYPES + ANALYSIS_DISTANCE_BUCKETS];
+    return true;
+}
+
+bool save_analysis(const char* trace_path, const trace_analysis_t& analysis)
+{
+    struct stat st;
+    std::string path = sidecar_path(trace_path);
+    if (stat(trace_path, &st) != 0) return false;
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for writing\n", path.c_str());
+        return false;
+    }
+
+    fprintf(file, "procsim-analysis %d\ntrace_size %llu\ntrace_mtime %llu.%09llu\n", ANALYSIS_VERSION,
+            (unsigned long long)st.st_size, (unsigned long long)st.st_mtim.tv_sec,
+            (unsigned long long)st.st_mtim.tv_nsec);
+    fprintf(file, "instructions %llu\nop_mix", (unsigned long long)analysis.instructions);
+    for (int t = 0; t < FU_TYPES; t++) fprintf(file, " %llu", (unsigned long long)analysis.op_mix[t]);
+    fprintf(file, "\noperands %llu\nlive_in %llu\ndistance_sum %llu\ndistance",
+            (unsigned long long)analysis.operands, (unsigned long long)analysis.live_in,
+            (unsigned long long)analysis.distance_sum);
+    for (int b = 0; b < ANALYSIS_DISTANCE_BUCKETS; b++) fprintf(file, " %llu", (unsigned long long)analysis.distance[b]);
+    fprintf(file, "\ncritical_path %llu\n", (unsigned long long)analysis.critical_path);
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Failed to write %s\n", path.c_str());
+    return ok;
+}
+
+// cycles to push count operations through width slots a cycle
+static uint64_t throughput_cycles(uint64_t count, uint64_t width)
+{
+    if (count == 0) return 0;
+    if (width == 0) return UINT64_MAX;
+    return (count + width - 1) / width;
+}
+
+uint64_t cycle_bound(const trace_analysis_t& analysis, const sweep_config_t& config, const char** limit)
+{
+    static const char* fu_names[FU_TYPES] = { "k0", "k1", "k2" };
+    uint64_t fu_widths[FU_TYPES] = { config.k0, config.k1, config.k2 };
+
+    uint64_t bound = throughput_cycles(analysis.instructions, config.f);
+    const char* name = "fetch";
+    uint64_t bus = throughput_cycles(analysis.instructions, config.r);
+    if (bus > bound) {
+        bound = bus;
+        name = "bus";
+    }
+
+    uint64_t min_latency = UINT64_MAX;
+    for (int t = 0; t < FU_TYPES; t++) {
+        uint64_t latency = std::max(config.timing.latency[t], (uint64_t)1);
+        uint64_t busy = config.timing.pipelined[t] ? 1 : latency;
+        uint64_t fu = throughput_cycles(analysis.op_mix[t] * busy, fu_widths[t]);
+        if (fu > bound) {
+            bound = fu;
+            name = fu_names[t];
+        }
+        if (analysis.op_mix[t] > 0) min_latency = std::min(min_latency, latency);
+    }
+    if (min_latency != UINT64_MAX && analysis.critical_path * min_latency > bound) {
+        bound = analysis.critical_path * min_latency;
+        name = "dependency";
+    }
+
+    if (limit) *limit = name;
+    return bound;
+}
+
+double ipc_ceiling(const trace_analysis_t& analysis, const sweep_config_t& config)
+{
+    uint64_t bound = cycle_bound(analysis, config, NULL);
+    if (bound == 0) return 0.0;
+    return (double)analysis.instructions / (double)bound;
+}
+
+void print_bound_header(FILE* out, bool exact)
+{
+    fprintf(out, "R,k0,k1,k2,F,cycle_bound,ipc_ceiling,limit%s\n", exact ? ",cycle_count,bound_pct" : "");
+}
+
+void print_bound_row(FILE* out, const trace_analysis_t& analysis, const sweep_config_t& config,
+                     const proc_stats_t* exact)
+{
+    const char* limit;
+    uint64_t bound = cycle_bound(analysis, config, &limit);
+    fprintf(out, "%llu,%llu,%llu,%llu,%llu,%llu,%f,%s",
+            (unsigned long long)config.r, (unsigned long long)config.k0,
+            (unsigned long long)config.k1, (unsigned long long)config.k2,
+            (unsigned long long)config.f, (unsigned long long)bound,
+            ipc_ceiling(analysis, config), limit);
+    if (exact) {
+        fprintf(out, ",%lu,%.1f", exact->cycle_count,
+                exact->cycle_count ? 100.0 * bound / exact->cycle_count : 0.0);
+    }
+    fprintf(out, "\n");
+}
+
+size_t prune_configs(const trace_analysis_t& analysis, double target_ipc, std::vector<sweep_config_t>& configs)
+{
+    size_t before = configs.size();
+    configs.erase(std::remove_if(configs.begin(), configs.end(), [&](const sweep_config_t& config) {
+        return ipc_ceiling(analysis, config) < target_ipc;
+    }), configs.end());
+    return before - configs.size();
+}
@@ -0,0 +1,62 @@
+#ifndef PROCSIM_ANALYZE_HPP
+#define PROCSIM_ANALYZE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "procsim.hpp"
+#include "procsim_sweep.hpp"
+
+// Dependency distances are bucketed by powers of two: bucket b counts
+// distances in [2^b, 2^(b+1)), the last bucket everything beyond
+#define ANALYSIS_DISTANCE_BUCKETS 16
+
+// What a trace allows independently of any machine: its op-code mix and
+// its register (RAW) dependence structure
+typedef struct _trace_analysis_t
+{
+    uint64_t instructions;
+    uint64_t op_mix[FU_TYPES];      // by FU type, op code -1 counted as k1
+    uint64_t operands;              // source registers read
+    uint64_t live_in;               // read before any instruction wrote them
+    uint64_t distance_sum;          // producer-to-consumer distance, in instructions
+    uint64_t distance[ANALYSIS_DISTANCE_BUCKETS];
+    uint64_t critical_path;         // longest dependence chain, in instructions
+} trace_analysis_t;
+
+void analyze_trace(const std::vector<proc_inst_t>& trace, trace_analysis_t* p_analysis);
+
+// instructions per link of the critical path, the IPC of an unbounded machine
+double ideal_ilp(const trace_analysis_t& analysis);
+
+void print_analysis(FILE* out, const trace_analysis_t& analysis);
+
+// The sidecar is trace_path + ".analysis". It records the trace's size and
+// modification time to the nanosecond, and load_analysis refuses it
+// (returns false) once they no longer match, so an edited trace is
+// analyzed again.
+bool load_analysis(const char* trace_path, trace_analysis_t* p_analysis);
+bool save_analysis(const char* trace_path, const trace_analysis_t& analysis);
+
+// A lower bound on the cycles config needs for the trace, from whichever of
+// these is largest: fetching F and broadcasting R instructions per cycle at
+// most, each FU type's throughput (k units, each busy for the latency unless
+// pipelined), and the critical path at one latency per link. UINT64_MAX if
+// the trace uses an FU type config has none of. limit, if given, receives
+// the name of the deciding term.
+uint64_t cycle_bound(const trace_analysis_t& analysis, const sweep_config_t& config, const char** limit);
+
+// the highest IPC config could reach on the trace, instructions / cycle_bound
+double ipc_ceiling(const trace_analysis_t& analysis, const sweep_config_t& config);
+
+// CSV of cycle_bound per configuration; with exact, also the simulated
+// cycles and the bound as a percentage of them
+void print_bound_header(FILE* out, bool exact);
+void print_bound_row(FILE* out, const trace_analysis_t& analysis, const sweep_config_t& config,
+                     const proc_stats_t* exact);
+
+// drops every configuration whose ceiling is below target_ipc; returns the
+// number dropped
+size_t prune_configs(const trace_analysis_t& analysis, double target_ipc, std::vector<sweep_config_t>& configs);
+
+#endif
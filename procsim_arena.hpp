@@ -0,0 +1,122 @@
+#ifndef PROCSIM_ARENA_HPP
+#define PROCSIM_ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace procsim {
+
+// Bump allocator for one simulator's per-run state. Memory is never freed
+// piecemeal; reset() rewinds to the first block and keeps every block, so a
+// core that repeats the same shape makes the same requests, finds them room
+// in the same blocks, and stops allocating after its first run. A request
+// that does not fit the current block moves on to the next one, adding a
+// block (double the size of the last) when the chain runs out.
+class Arena {
+public:
+    Arena() : current(0), used(0), system_allocs(0) {}
+    ~Arena() {
+        for (auto& block : blocks) ::operator delete(block.data);
+    }
+
+    void* allocate(size_t bytes, size_t align) {
+        for (;;) {
+            if (current < blocks.size()) {
+                size_t start = (used + align - 1) & ~(align - 1);
+                if (start + bytes <= blocks[current].size) {
+                    used = start + bytes;
+                    return blocks[current].data + start;
+                }
+                if (current + 1 < blocks.size()) {
+                    current++;
+                    used = 0;
+                    continue;
+                }
+            }
+            size_t size = blocks.empty() ? FIRST_BLOCK : blocks.back().size * 2;
+            if (size < bytes + align) size = bytes + align;
+            Block block = { static_cast<char*>(::operator new(size)), size };
+            blocks.push_back(block);
+            system_allocs++;
+            current = blocks.size() - 1;
+            used = 0;
+        }
+    }
+
+    // invalidates everything handed out so far
+    void reset() {
+        current = 0;
+        used = 0;
+    }
+
+    // calls to the system allocator so far
+    uint64_t system_allocations() const { return system_allocs; }
+
+private:
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+    static const size_t FIRST_BLOCK = 64 * 1024;
+
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current;         // block being bumped
+    size_t used;            // bytes taken from it
+    uint64_t system_allocs;
+};
+
+// std::allocator stand-in over an Arena, where deallocate is a no-op. A
+// default-constructed one (no arena) uses the heap, so containers can exist
+// before their owner attaches them to its arena. Moving or swapping a
+// container carries its allocator along.
+template <class T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator() : arena(NULL) {}
+    explicit ArenaAllocator(Arena* arena) : arena(arena) {}
+    template <class U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        if (arena == NULL) return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t) {
+        if (arena == NULL) ::operator delete(p);
+    }
+
+    template <class U> struct rebind { typedef ArenaAllocator<U> other; };
+
+    Arena* arena;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+// empties v and points it at arena; its old storage is simply abandoned
+// (or freed, if it came from the heap). After Arena::reset(), every
+// container must be attached again before it is used.
+template <class T>
+void arena_attach(ArenaVector<T>& v, Arena* arena)
+{
+    v = ArenaVector<T>(ArenaAllocator<T>(arena));
+}
+
+} // namespace procsim
+
+#endif
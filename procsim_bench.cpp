@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include "procsim.hpp"
+#include "procsim_sweep.hpp"
+#include "procsim_trace.hpp"
+
+using namespace procsim;
+
+//
+// procsim-bench
+//
+//  replays the bundled traces from memory over a grid of configurations with
+//  logging off and prints one CSV row per (trace, configuration): host-side
+//  simulated instructions per second, nanoseconds per simulated cycle and the
+//  share of loop time spent in each stage. Each row reuses one core, and the
+//  heap allocations of its first and later runs are counted to show that
+//  per-run state comes from the core's arena. A configuration that deadlocks
+//  is reported and gets no row.
+//
+
+// every heap allocation in the process
+static uint64_t heap_allocations = 0;
+
+void* operator new(size_t n)
+{
+    heap_allocations++;
+    void* p = malloc(n ? n : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+static const char* default_traces[] = { "gcc", "gobmk", "hmmer", "mcf" };
+
+// small, mid and wide machines; the PROCSIM_FIXED_SHAPES ones plus a few on
+// the dynamic SoA path (16,4,4,4,8 has the same RS size as 8,4,4,4,8)
+static const sweep_config_t default_grid[] = {
+    { 8, 1, 2, 3, 4, {} },
+    { 2, 3, 2, 1, 4, {} },
+    { 4, 2, 2, 2, 4, {} },
+    { 8, 4, 4, 4, 8, {} },
+    { 1, 1, 1, 1, 8, {} },
+    { 16, 4, 4, 4, 8, {} },
+    { 32, 8, 8, 8, 16, {} },
+};
+
+static void print_help_and_exit(void) {
+    printf("procsim-bench [OPTIONS]\n");
+    printf("  -d dir\t\tDirectory holding <name>.100k.trace (default traces)\n");
+    printf("  -S sweep.txt\tConfiguration grid, as for procsim -S (default built in)\n");
+    printf("  -n N\t\tTimed repetitions per row, best kept (default 3)\n");
+    printf("  -x L0,L1,L2\tExecute latency in cycles per FU type (default 1,1,1)\n");
+    printf("  -p P0,P1,P2\t1 = FU type is pipelined (default 0,0,0)\n");
+    printf("  -q N\t\tDispatch queue capacity; a full queue stalls fetch (default unbounded)\n");
+    printf("  -B policy\tResult bus arbitration: oldest (default) or fu:T,T,T (FU types, highest priority first)\n");
+    printf("  -A layout\tRS implementation: lists (default) or soa (bitmasks, SIMD wakeup)\n");
+    printf("  \t\t-x, -p, -q, -B and -A apply to every configuration of the grid\n");
+    printf("  -h\t\tThis helpful output\n");
+    exit(0);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the cost of one steady_clock read, which every timed stage pays once
+static double clock_read_ns(void)
+{
+    const int reads = 1 << 20;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < reads; i++) {
+        std::chrono::steady_clock::now();
+    }
+    return seconds_since(start) * 1e9 / reads;
+}
+
+// one run on core, with the stage split added to times if given; returns
+// host seconds and the heap allocations it made
+static double run_once(Core& core, const std::vector<proc_inst_t>& trace, const sweep_config_t& config,
+                       stage_times_t* times, proc_stats_t* p_stats, uint64_t* allocations)
+{
+    ArraySource source(trace.data(), trace.size());
+    core.set_source(&source);
+    core.set_stage_times(times);
+
+    uint64_t before = heap_allocations;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    setup_config(core, config);
+    core.run_proc();
+    core.complete_proc(p_stats);
+    double seconds = seconds_since(start);
+    *allocations = heap_allocations - before;
+    return seconds;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* dir = "traces";
+    const char* sweep_file = NULL;
+    int repetitions = 3;
+    int opt;
+    // the machine options every grid configuration runs with
+    sweep_config_t machine = { 0, 0, 0, 0, 0, {}, 0, { BUS_OLDEST_FIRST, { 0, 1, 2 } }, RS_LAYOUT_LISTS };
+    for (int t = 0; t < FU_TYPES; t++) {
+        machine.timing.latency[t] = DEFAULT_FU_LATENCY;
+        machine.timing.pipelined[t] = false;
+    }
+
+    while (-1 != (opt = getopt(argc, argv, "d:S:n:x:p:q:B:A:h"))) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'S':
+            sweep_file = optarg;
+            break;
+        case 'n':
+            repetitions = atoi(optarg);
+            if (repetitions < 1) print_help_and_exit();
+            break;
+        case 'x':
+        case 'p':
+        case 'q':
+        case 'B':
+        case 'A':
+            if (!parse_machine_option(opt, optarg, &machine)) print_help_and_exit();
+            break;
+        default:
+            print_help_and_exit();
+            break;
+        }
+    }
+
+    std::vector<sweep_config_t> configs;
+    if (sweep_file != NULL) {
+        if (!parse_sweep_file(sweep_file, configs)) {
+            return 1;
+        }
+    } else {
+        configs.assign(default_grid, default_grid + sizeof(default_grid) / sizeof(default_grid[0]));
+    }
+    apply_machine_options(machine, configs);
+
+    printf("trace,R,k0,k1,k2,F,instructions,cycles,seconds,inst_per_sec,ns_per_cycle,"
+           "fetch_pct,dispatch_pct,schedule_pct,execute_pct,state_update_pct,first_run_allocs,run_allocs\n");
+
+    double overhead_ns = clock_read_ns();
+    uint64_t all_instructions = 0;
+    double all_seconds = 0.0;
+    for (const char* name : default_traces) {
+        std::string path = std::string(dir) + "/" + name + ".100k.trace";
+        FILE* file = fopen(path.c_str(), "r");
+        if (file == NULL) {
+            fprintf(stderr, "Failed to open %s for reading\n", path.c_str());
+            return 1;
+        }
+        InstructionSource* source = open_trace(fileno(file));
+        if (source == NULL) {
+            return 1;
+        }
+        std::vector<proc_inst_t> trace;
+        load_trace(*source, trace);
+        delete source;
+        fclose(file);
+
+        for (auto& config : configs) {
+            Core core(NULL, NULL, NULL, LOG_OFF);
+            proc_stats_t stats;
+            double best = 0.0;
+            uint64_t first_allocs = 0;
+            uint64_t run_allocs = 0;     // most made by any run after the first
+            uint64_t allocs = 0;
+            for (int i = 0; i < repetitions; i++) {
+                double seconds = run_once(core, trace, config, NULL, &stats, &allocs);
+                // a deadlocked run's partial stats would pass for a real row
+                if (core.deadlocked()) break;
+                if (i == 0 || seconds < best) best = seconds;
+                if (i == 0) first_allocs = allocs;
+                else run_allocs = std::max(run_allocs, allocs);
+            }
+            if (core.deadlocked()) {
+                report_deadlock(config);
+                continue;
+            }
+
+            // the split comes from a separate run, so the clock reads don't
+            // slow the timed ones
+            stage_times_t times;
+            memset(&times, 0, sizeof(times));
+            run_once(core, trace, config, &times, &stats, &allocs);
+            run_allocs = std::max(run_allocs, allocs);
+            double stage_ns[] = { (double)times.fetch, (double)times.dispatch, (double)times.schedule,
+                                  (double)times.execute, (double)times.state_update };
+            double total = 0.0;
+            for (double& ns : stage_ns) {
+                ns = std::max(0.0, ns - overhead_ns * times.halves);
+                total += ns;
+            }
+            if (total == 0.0) total = 1.0;
+
+            printf("%s,%llu,%llu,%llu,%llu,%llu,%lu,%lu,%f,%.0f,%.2f,%.1f,%.1f,%.1f,%.1f,%.1f,%llu,%llu\n", name,
+                   (unsigned long long)config.r, (unsigned long long)config.k0,
+                   (unsigned long long)config.k1, (unsigned long long)config.k2,
+                   (unsigned long long)config.f, stats.retired_instruction, stats.cycle_count, best,
+                   stats.retired_instruction / best, best * 1e9 / (double)stats.cycle_count,
+                   100.0 * stage_ns[0] / total, 100.0 * stage_ns[1] / total,
+                   100.0 * stage_ns[2] / total, 100.0 * stage_ns[3] / total,
+                   100.0 * stage_ns[4] / total,
+                   (unsigned long long)first_allocs, (unsigned long long)run_allocs);
+            fflush(stdout);
+
+            all_instructions += stats.retired_instruction;
+            all_seconds += best;
+        }
+    }
+
+    if (all_seconds > 0.0) {
+        fprintf(stderr, "overall: %.0f simulated instructions/s\n", all_instructions / all_seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,405 @@
+#include "procsim.hpp"
+#include <cstdio>
+#include <cstring>
+
+// Checkpoint file (and Core::fork, which copies the same fields): the magic, a version, sizeof(rs_entry_t) (checkpoints
+// only load into the same build), the configuration, then every Core field
+// in declaration order. Vectors are a uint64_t length followed by their raw
+// elements; the completion rings are stored as RS slot indices.
+
+using namespace procsim;
+
+static const char CHECKPOINT_MAGIC[8] = { 'P', 'S', 'I', 'M', 'C', 'K', 'P', '\x01' };
+static const uint32_t CHECKPOINT_VERSION = 5;
+
+namespace {
+
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(FILE* file) : file(file), ok(true) {}
+
+    template <class T> void put(const T& value) {
+        if (ok && fwrite(&value, sizeof(T), 1, file) != 1) ok = false;
+    }
+    template <class V> void put_vector(const V& values) {
+        typedef typename V::value_type T;
+        put((uint64_t)values.size());
+        if (ok && !values.empty() && fwrite(values.data(), sizeof(T), values.size(), file) != values.size()) {
+            ok = false;
+        }
+    }
+
+    FILE* file;
+    bool ok;
+};
+
+class CheckpointReader {
+public:
+    explicit CheckpointReader(FILE* file) : file(file), ok(true) {}
+
+    template <class T> void get(T& value) {
+        if (ok && fread(&value, sizeof(T), 1, file) != 1) ok = false;
+    }
+    // lengths must match what setup_proc sized the vector to, unless it is
+    // a list that may hold up to `limit` entries
+    template <class V> void get_vector(V& values, bool sized, uint64_t limit = 0) {
+        typedef typename V::value_type T;
+        uint64_t count = 0;
+        get(count);
+        if (!ok || (sized ? count != values.size() : count > limit)) {
+            ok = false;
+            return;
+        }
+        values.resize(count);
+        if (count > 0 && fread(values.data(), sizeof(T), count, file) != count) ok = false;
+    }
+
+    FILE* file;
+    bool ok;
+};
+
+} // namespace
+
+bool Core::save_checkpoint(FILE* out)
+{
+    CheckpointWriter w(out);
+    w.put(CHECKPOINT_MAGIC);
+    w.put(CHECKPOINT_VERSION);
+    w.put((uint32_t)sizeof(rs_entry_t));
+    w.put(RESULT_BUSES);
+    w.put(K0_FU_COUNT);
+    w.put(K1_FU_COUNT);
+    w.put(K2_FU_COUNT);
+    w.put(FETCH_RATE);
+    w.put((uint32_t)rs_layout);
+    for (int t = 0; t < FU_TYPES; t++) {
+        w.put(fu_timing.latency[t]);
+        w.put((uint8_t)fu_timing.pipelined[t]);
+    }
+    w.put((uint32_t)bus_arbitration.policy);
+    for (int t = 0; t < FU_TYPES; t++) {
+        w.put((int32_t)bus_arbitration.order[t]);
+    }
+    w.put(dispatch_limit);
+
+    // the trace offset: every instruction read so far has been given a tag
+    w.put(global_tag_counter);
+    w.put(current_cycle);
+    w.put((uint8_t)done_fetching);
+
+    w.put((uint64_t)dispatch_queue.size());
+    for (size_t i = 0; i < dispatch_queue.size(); i++) {
+        const QueuedInstruction& q = dispatch_queue.at(i);
+        w.put(q.inst);
+        w.put(q.fetch_cycle);
+    }
+
+    w.put_vector(reservation_station);
+    w.put_vector(free_mask);
+    w.put(free_count);
+    w.put_vector(ready_queue);
+    w.put_vector(broadcast_now);
+    w.put_vector(retiring);
+    w.put_vector(soa_tag);
+    for (int i = 0; i < 2; i++) {
+        w.put_vector(soa_parent[i]);
+        w.put_vector(src_ready_mask[i]);
+    }
+    w.put_vector(fired_mask);
+    w.put_vector(dep_head);
+    w.put_vector(dep_next);
+    w.put_vector(result_buses);
+
+    for (int t = 0; t < FU_TYPES; t++) {
+        w.put((uint64_t)completed_instructions.size(t));
+        for (size_t i = 0; i < completed_instructions.size(t); i++) {
+            w.put(completed_instructions.at(t, i));
+        }
+    }
+
+    for (int32_t i = 0; i < NUM_REGISTERS; i++) {
+        w.put(register_status[i]);
+    }
+
+    w.put(k0_counter);
+    w.put(k1_counter);
+    w.put(k2_counter);
+    for (int t = 0; t < FU_TYPES; t++) {
+        w.put(fu_issued[t]);
+    }
+    w.put((uint64_t)wheel.size());
+    for (auto& bucket : wheel) {
+        w.put_vector(bucket);
+    }
+    w.put(wheel_count);
+
+    w.put(max_disp_size);
+    w.put(total_disp_size);
+    w.put(instructions_fired);
+    w.put(instructions_retired);
+    w.put(bus_demand_peak);
+    w.put(counters.dispatch_stall_cycles);
+    for (int t = 0; t < FU_TYPES; t++) {
+        w.put(counters.fu_stall_cycles[t]);
+    }
+    w.put(counters.bus_overflow_cycles);
+    w.put(counters.ready_not_fired);
+    w.put_vector(counters.rs_occupancy);
+
+    // timing rows retired ahead of an older, still in-flight tag
+    std::vector<std::pair<uint64_t, InstructionCycles> > rows;
+    instruction_cycles.pending(rows);
+    w.put(instruction_cycles.next_tag());
+    w.put_vector(rows);
+
+    if (w.ok && fflush(out) != 0) w.ok = false;
+    if (!w.ok) {
+        fprintf(stderr, "Failed to write checkpoint\n");
+    }
+    return w.ok;
+}
+
+// whether every element of values indexes below size, or is Core::NO_DEP
+// (UINT32_MAX) where that is allowed
+template <class V>
+static bool indices_below(const V& values, uint64_t size, bool none_allowed)
+{
+    for (uint32_t index : values) {
+        if (index >= size && !(none_allowed && index == UINT32_MAX)) return false;
+    }
+    return true;
+}
+
+bool Core::restore_checkpoint(FILE* in)
+{
+    CheckpointReader r(in);
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    uint32_t version = 0;
+    uint32_t entry_size = 0;
+    r.get(magic);
+    r.get(version);
+    r.get(entry_size);
+    if (!r.ok || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+        version != CHECKPOINT_VERSION || entry_size != sizeof(rs_entry_t)) {
+        fprintf(stderr, "Not a checkpoint from this version of procsim\n");
+        return false;
+    }
+
+    uint64_t r_count = 0, k0 = 0, k1 = 0, k2 = 0, f = 0;
+    uint32_t layout = 0;
+    fu_timing_t timing;
+    r.get(r_count);
+    r.get(k0);
+    r.get(k1);
+    r.get(k2);
+    r.get(f);
+    r.get(layout);
+    for (int t = 0; t < FU_TYPES; t++) {
+        uint8_t pipelined = 0;
+        r.get(timing.latency[t]);
+        r.get(pipelined);
+        timing.pipelined[t] = (pipelined != 0);
+    }
+    uint32_t policy = 0;
+    bus_arbitration_t arbitration;
+    r.get(policy);
+    arbitration.policy = (bus_policy_t)policy;
+    bool order_ok = true;
+    for (int t = 0; t < FU_TYPES; t++) {
+        int32_t type = 0;
+        r.get(type);
+        arbitration.order[t] = type;
+        if (type < 0 || type >= FU_TYPES) order_ok = false;
+    }
+    uint64_t limit = 0;
+    r.get(limit);
+    if (!r.ok || layout > RS_LAYOUT_SOA || policy > BUS_FU_PRIORITY || !order_ok) {
+        fprintf(stderr, "Corrupt checkpoint header\n");
+        return false;
+    }
+
+    // size every buffer for the saved machine, then fill them in
+    set_fu_timing(timing);
+    set_rs_layout((rs_layout_t)layout);
+    set_bus_arbitration(arbitration);
+    set_dispatch_limit(limit);
+    setup_proc(r_count, k0, k1, k2, f);
+    uint64_t rs_size = reservation_station.size();
+
+    uint64_t offset = 0;
+    uint8_t done = 0;
+    r.get(offset);
+    r.get(current_cycle);
+    r.get(done);
+    done_fetching = (done != 0);
+
+    uint64_t queued = 0;
+    r.get(queued);
+    for (uint64_t i = 0; r.ok && i < queued; i++) {
+        QueuedInstruction q;
+        r.get(q.inst);
+        r.get(q.fetch_cycle);
+        if (!valid_instruction(q.inst)) r.ok = false;
+        dispatch_queue.push_back(q.inst, q.fetch_cycle);
+    }
+
+    r.get_vector(reservation_station, true);
+    r.get_vector(free_mask, true);
+    r.get(free_count);
+    r.get_vector(ready_queue, false, rs_size);
+    r.get_vector(broadcast_now, false, rs_size);
+    r.get_vector(retiring, false, rs_size);
+    r.get_vector(soa_tag, true);
+    for (int i = 0; i < 2; i++) {
+        r.get_vector(soa_parent[i], true);
+        r.get_vector(src_ready_mask[i], true);
+    }
+    r.get_vector(fired_mask, true);
+    r.get_vector(dep_head, true);
+    r.get_vector(dep_next, true);
+    r.get_vector(result_buses, true);
+    // every slot index is checked before the stages follow it; dependency
+    // links name a consumer slot and source, slot * 2 + source
+    if (!indices_below(ready_queue, rs_size, false) || !indices_below(broadcast_now, rs_size, false) ||
+        !indices_below(retiring, rs_size, false) || !indices_below(dep_head, 2 * rs_size, true) ||
+        !indices_below(dep_next, 2 * rs_size, true)) {
+        r.ok = false;
+    }
+    for (const rs_entry_t& entry : reservation_station) {
+        if (entry.valid && !valid_instruction(entry.instruction)) r.ok = false;
+    }
+    for (const ResultBus& bus : result_buses) {
+        if (bus.busy && (bus.reg < -1 || bus.reg >= NUM_REGISTERS)) r.ok = false;
+    }
+
+    uint64_t completed_total = 0;
+    for (int t = 0; t < FU_TYPES; t++) {
+        uint64_t completed = 0;
+        r.get(completed);
+        completed_total += completed;
+        if (completed_total > rs_size) r.ok = false;
+        for (uint64_t i = 0; r.ok && i < completed; i++) {
+            uint32_t slot = 0;
+            r.get(slot);
+            if (slot >= rs_size) r.ok = false;
+            if (r.ok) completed_instructions.push(t, slot);
+        }
+    }
+
+    for (int32_t i = 0; i < NUM_REGISTERS; i++) {
+        r.get(register_status[i]);
+        // the slot only means something while its writer is in flight
+        if (!register_status[i].ready && register_status[i].slot >= rs_size) r.ok = false;
+    }
+
+    r.get(k0_counter);
+    r.get(k1_counter);
+    r.get(k2_counter);
+    for (int t = 0; t < FU_TYPES; t++) {
+        r.get(fu_issued[t]);
+    }
+    uint64_t buckets = 0;
+    r.get(buckets);
+    if (buckets != wheel.size()) r.ok = false;
+    for (size_t i = 0; r.ok && i < wheel.size(); i++) {
+        r.get_vector(wheel[i], false, rs_size);
+        if (!indices_below(wheel[i], rs_size, false)) r.ok = false;
+    }
+    r.get(wheel_count);
+
+    r.get(max_disp_size);
+    r.get(total_disp_size);
+    r.get(instructions_fired);
+    r.get(instructions_retired);
+    r.get(bus_demand_peak);
+    r.get(counters.dispatch_stall_cycles);
+    for (int t = 0; t < FU_TYPES; t++) {
+        r.get(counters.fu_stall_cycles[t]);
+    }
+    r.get(counters.bus_overflow_cycles);
+    r.get(counters.ready_not_fired);
+    r.get_vector(counters.rs_occupancy, true);
+
+    uint64_t next_tag = 0;
+    std::vector<std::pair<uint64_t, InstructionCycles> > rows;
+    r.get(next_tag);
+    r.get_vector(rows, false, offset);
+    instruction_cycles.skip_to(next_tag);
+    if (timing_rows && (output || timing_log)) {
+        for (auto& row : rows) {
+            instruction_cycles.retire(row.first, row.second);
+        }
+    }
+
+    if (!r.ok) {
+        fprintf(stderr, "Truncated or corrupt checkpoint\n");
+        return false;
+    }
+
+    // bring the source up to the saved trace offset
+    global_tag_counter = offset;
+    if (source->skip(offset) != offset) {
+        fprintf(stderr, "Trace is shorter than the checkpoint's offset\n");
+        return false;
+    }
+    return true;
+}
+
+void Core::fork(const Core& from, uint64_t r)
+{
+    set_fu_timing(from.fu_timing);
+    set_rs_layout(from.rs_layout);
+    set_bus_arbitration(from.bus_arbitration);
+    set_dispatch_limit(from.dispatch_limit);
+    setup_proc(r, from.K0_FU_COUNT, from.K1_FU_COUNT, from.K2_FU_COUNT, from.FETCH_RATE);
+
+    // every buffer now has from's shape; copying keeps this core's arena
+    fetch_buffer = from.fetch_buffer;
+    dispatch_queue = from.dispatch_queue;
+    reserved_slots = from.reserved_slots;
+    reservation_station = from.reservation_station;
+    free_mask = from.free_mask;
+    free_count = from.free_count;
+    ready_queue = from.ready_queue;
+    broadcast_now = from.broadcast_now;
+    retiring = from.retiring;
+    soa_tag = from.soa_tag;
+    for (int i = 0; i < 2; i++) {
+        soa_parent[i] = from.soa_parent[i];
+        src_ready_mask[i] = from.src_ready_mask[i];
+    }
+    fired_mask = from.fired_mask;
+    dep_head = from.dep_head;
+    dep_next = from.dep_next;
+    wakeups = from.wakeups;
+    // buses past r are never driven again
+    for (size_t b = 0; b < result_buses.size() && b < from.result_buses.size(); b++) {
+        result_buses[b] = from.result_buses[b];
+    }
+    completed_instructions = from.completed_instructions;
+    for (int32_t i = 0; i < NUM_REGISTERS; i++) {
+        register_status[i] = from.register_status[i];
+    }
+
+    k0_counter = from.k0_counter;
+    k1_counter = from.k1_counter;
+    k2_counter = from.k2_counter;
+    for (int t = 0; t < FU_TYPES; t++) {
+        fu_issued[t] = from.fu_issued[t];
+    }
+    wheel = from.wheel;
+    wheel_count = from.wheel_count;
+
+    global_tag_counter = from.global_tag_counter;
+    current_cycle = from.current_cycle;
+    max_disp_size = from.max_disp_size;
+    total_disp_size = from.total_disp_size;
+    instructions_fired = from.instructions_fired;
+    instructions_retired = from.instructions_retired;
+    done_fetching = from.done_fetching;
+    bus_demand_peak = from.bus_demand_peak;
+    instruction_cycles.skip_to(from.instruction_cycles.next_tag());
+    counters = from.counters;
+    blocked_count = from.blocked_count;
+    blocked_types = from.blocked_types;
+}
@@ -0,0 +1,79 @@
+#include <cstdio>
+#include <cstring>
+#include "procsim_trace.hpp"
+
+//
+// procsim-convert
+//
+//  turns any trace procsim reads (text, gzip or zstd text, or binary) into
+//  the binary, memory-mappable trace format
+//
+
+// drops the partial output of a failed conversion
+static int fail(FILE* out, const char* path)
+{
+    fclose(out);
+    remove(path);
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: procsim-convert in.trace out.btrace\n");
+        return 1;
+    }
+
+    FILE* in = fopen(argv[1], "r");
+    if (in == NULL) {
+        fprintf(stderr, "Failed to open %s for reading\n", argv[1]);
+        return 1;
+    }
+    procsim::InstructionSource* reader = procsim::open_trace(fileno(in));
+    if (reader == NULL) {
+        return 1;
+    }
+    FILE* out = fopen(argv[2], "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open %s for writing\n", argv[2]);
+        delete reader;
+        return 1;
+    }
+
+    // the count is patched in once the whole trace has been read
+    trace_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(trace_record_t);
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+    proc_inst_t inst;
+    trace_record_t rec;
+    while (ok && reader->read(&inst)) {
+        if (!encode_record(&inst, &rec)) {
+            fprintf(stderr, "%s: instruction %llu does not fit the binary format\n",
+                    argv[1], (unsigned long long)header.count + 1);
+            delete reader;
+            return fail(out, argv[2]);
+        }
+        ok = fwrite(&rec, sizeof(rec), 1, out) == 1;
+        header.count++;
+    }
+    delete reader;
+    fclose(in);
+
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1 && fflush(out) == 0;
+    if (!ok) {
+        perror(argv[2]);
+        return fail(out, argv[2]);
+    }
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        remove(argv[2]);
+        return 1;
+    }
+
+    printf("%llu instructions\n", (unsigned long long)header.count);
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include "procsim.hpp"
+#include "procsim_digest.hpp"
+#include "procsim_log.hpp"
+#include <cstdio>
+
+// The free setup_proc/run_proc/complete_proc API over one process-wide core,
+// reading through the driver's read_instruction(). Kept out of libprocsim so
+// embedders only get the re-entrant procsim::Core.
+
+using namespace procsim;
+
+// default core used by the free setup_proc/run_proc/complete_proc functions
+static ReadInstructionSource default_source;
+static Core* default_core = NULL;
+
+static fu_timing_t default_fu_timing = {
+    { DEFAULT_FU_LATENCY, DEFAULT_FU_LATENCY, DEFAULT_FU_LATENCY }, { false, false, false }
+};
+
+void set_fu_timing(const fu_timing_t* timing)
+{
+    default_fu_timing = *timing;
+}
+
+static rs_layout_t default_rs_layout = RS_LAYOUT_LISTS;
+
+void set_rs_layout(rs_layout_t layout)
+{
+    default_rs_layout = layout;
+}
+
+static bus_arbitration_t default_bus_arbitration = { BUS_OLDEST_FIRST, { 0, 1, 2 } };
+
+void set_bus_arbitration(const bus_arbitration_t* arbitration)
+{
+    default_bus_arbitration = *arbitration;
+}
+
+static uint64_t default_dispatch_limit = 0;
+
+void set_dispatch_limit(uint64_t limit)
+{
+    default_dispatch_limit = limit;
+}
+
+static progress_options_t default_progress = { 0, 0.0, NULL };
+static ProgressSink* progress_sink = NULL;
+
+void set_progress(const progress_options_t* options)
+{
+    progress_options_t off = { 0, 0.0, NULL };
+    default_progress = options ? *options : off;
+    delete progress_sink;
+    progress_sink = NULL;
+}
+
+static digest_options_t default_digest_options = { NULL, false, 0 };
+static RunDigest* default_digest = NULL;
+
+bool set_digest(const digest_options_t* options)
+{
+    delete default_digest;
+    default_digest = NULL;
+    if (options == NULL || options->path == NULL) {
+        return true;
+    }
+    default_digest_options = *options;
+    default_digest = new RunDigest(options->interval ? options->interval : DIGEST_INTERVAL);
+    if (options->verify && !default_digest->load_golden(options->path)) {
+        delete default_digest;
+        default_digest = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool finish_digest(void)
+{
+    if (default_digest == NULL) {
+        return true;
+    }
+    if (!default_digest_options.verify) {
+        return default_digest->save(default_digest_options.path);
+    }
+    default_digest->report(stderr);
+    return default_digest->matches();
+}
+
+static output_options_t default_options = { LOG_EVENTS, "output.output", "log.txt", false, false, NULL, NULL };
+
+void set_output_options(const output_options_t* options)
+{
+    default_options = *options;
+}
+
+static FILE* open_or_warn(const char* path, const char* mode)
+{
+    FILE* file = fopen(path, mode);
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for writing\n", path);
+    }
+    return file;
+}
+
+static Core* get_default_core()
+{
+    if (default_core == NULL) {
+        const output_options_t& opts = default_options;
+        EventLog* logging = NULL;
+        FILE* output = NULL;
+        if (opts.level >= LOG_EVENTS) {
+            FILE* log_file = open_or_warn(opts.log_path, opts.binary_log ? "wb" : "w");
+            if (log_file && opts.binary_log) {
+                logging = new BinaryEventLog(log_file);
+            } else if (log_file) {
+                logging = new TextEventLog(log_file);
+            }
+        }
+        if (opts.level >= LOG_STATS) {
+            output = open_or_warn(opts.output_path, "w");
+        }
+        default_core = new Core(&default_source, logging, output, opts.level);
+        default_core->set_extended_stats(opts.extended_stats);
+        if (opts.level >= LOG_EVENTS && opts.timing_path != NULL) {
+            FILE* timing_file = open_or_warn(opts.timing_path, "wb");
+            if (timing_file) {
+                default_core->set_timing_log(new ColumnarTimingLog(timing_file));
+            }
+        }
+    }
+    return default_core;
+}
+
+// the sink for default_progress, opened the first time it is needed
+static ProgressSink* get_progress_sink()
+{
+    if (progress_sink == NULL && (default_progress.cycles > 0 || default_progress.seconds > 0.0)) {
+        FILE* file = stderr;
+        if (default_progress.path != NULL) {
+            file = open_or_warn(default_progress.path, "w");
+        }
+        if (file) {
+            progress_sink = new TextProgressSink(file);
+        }
+    }
+    return progress_sink;
+}
+
+void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f)
+{
+    Core* core = get_default_core();
+    core->set_fu_timing(default_fu_timing);
+    core->set_rs_layout(default_rs_layout);
+    core->set_bus_arbitration(default_bus_arbitration);
+    core->set_dispatch_limit(default_dispatch_limit);
+    core->set_progress(get_progress_sink(), default_progress.cycles, default_progress.seconds);
+    core->set_digest(default_digest);
+    core->setup_proc(r, k0, k1, k2, f);
+}
+
+// p_stats stays for the original API; complete_proc fills it
+void run_proc(proc_stats_t* p_stats)
+{
+    default_core->run_proc();
+}
+
+bool run_proc_until(uint64_t cycle)
+{
+    return default_core->run_until(cycle);
+}
+
+bool proc_deadlocked(void)
+{
+    return default_core->deadlocked();
+}
+
+uint64_t warm_proc(uint64_t n)
+{
+    return default_core->warm(n);
+}
+
+void complete_proc(proc_stats_t *p_stats)
+{
+    default_core->complete_proc(p_stats);
+    if (default_options.json_path != NULL) {
+        FILE* json = open_or_warn(default_options.json_path, "w");
+        if (json) {
+            default_core->print_json(json, *p_stats);
+            fclose(json);
+        }
+    }
+}
+
+bool save_checkpoint(const char* path)
+{
+    FILE* file = open_or_warn(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    bool ok = default_core->save_checkpoint(file);
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
+
+bool restore_checkpoint(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for reading\n", path);
+        return false;
+    }
+    Core* core = get_default_core();
+    core->set_progress(get_progress_sink(), default_progress.cycles, default_progress.seconds);
+    bool ok = core->restore_checkpoint(file);
+    fclose(file);
+    return ok;
+}
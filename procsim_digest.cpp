@@ -0,0 +1,141 @@
+#include "procsim_digest.hpp"
+#include <algorithm>
+
+using namespace procsim;
+
+#define DIGEST_VERSION 1
+
+RunDigest::RunDigest(uint64_t interval)
+    : interval(interval ? interval : 1), has_golden(false)
+{
+    begin();
+}
+
+void RunDigest::begin()
+{
+    rolling = 0;
+    pending = 0;
+    memset(last_state, 0, sizeof(last_state));
+    next_mark = interval;
+    marks.clear();
+    diverged = NO_MARK;
+}
+
+void RunDigest::fold(uint64_t cycle, const uint64_t state[5])
+{
+    // marks in the idle cycles before this one see the hash as it was
+    while (next_mark < cycle) {
+        mark(next_mark);
+        next_mark += interval;
+    }
+
+    rolling = mix(rolling ^ cycle);
+    rolling = mix(rolling ^ pending);
+    for (int i = 0; i < 5; i++) {
+        rolling = mix(rolling ^ state[i]);
+        last_state[i] = state[i];
+    }
+    pending = 0;
+
+    if (next_mark == cycle) {
+        mark(cycle);
+        next_mark += interval;
+    }
+}
+
+void RunDigest::finish(uint64_t cycle)
+{
+    while (next_mark <= cycle) {
+        mark(next_mark);
+        next_mark += interval;
+    }
+    mark(cycle);
+    if (has_golden && diverged == NO_MARK && marks.size() != golden.size()) {
+        diverged = marks.size();
+    }
+}
+
+void RunDigest::mark(uint64_t cycle)
+{
+    digest_mark_t m = { cycle, rolling };
+    marks.push_back(m);
+    if (!has_golden || diverged != NO_MARK) return;
+    size_t i = marks.size() - 1;
+    if (i >= golden.size() || golden[i].cycle != m.cycle || golden[i].hash != m.hash) {
+        diverged = i;
+    }
+}
+
+bool RunDigest::load_golden(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for reading\n", path);
+        return false;
+    }
+
+    int version = 0;
+    unsigned long long every = 0, cycle, hash;
+    bool ok = fscanf(file, "procsim-digest %d interval %llu", &version, &every) == 2 &&
+              version == DIGEST_VERSION && every > 0;
+    golden.clear();
+    while (ok && fscanf(file, "%llu %llx", &cycle, &hash) == 2) {
+        digest_mark_t m = { cycle, hash };
+        golden.push_back(m);
+    }
+    ok = ok && !ferror(file) && !golden.empty();
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "%s is not a procsim digest\n", path);
+        return false;
+    }
+
+    interval = every;
+    has_golden = true;
+    begin();
+    return true;
+}
+
+bool RunDigest::save(const char* path) const
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for writing\n", path);
+        return false;
+    }
+
+    fprintf(file, "procsim-digest %d\ninterval %llu\n", DIGEST_VERSION, (unsigned long long)interval);
+    for (auto& m : marks) {
+        fprintf(file, "%llu %016llx\n", (unsigned long long)m.cycle, (unsigned long long)m.hash);
+    }
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Failed to write %s\n", path);
+    return ok;
+}
+
+void RunDigest::report(FILE* out) const
+{
+    if (!has_golden) return;
+    if (diverged == NO_MARK) {
+        fprintf(out, "Digest matches golden: %llu cycles, %016llx\n",
+                (unsigned long long)marks.back().cycle, (unsigned long long)rolling);
+        return;
+    }
+
+    // the last matching mark, and the first cycle either run marked after it
+    uint64_t lo = diverged ? marks[diverged - 1].cycle : 0;
+    uint64_t hi = lo + 1;
+    if (diverged < marks.size() && diverged < golden.size()) {
+        hi = std::max(hi, std::min(marks[diverged].cycle, golden[diverged].cycle));
+    }
+    if (hi == lo + 1) {
+        fprintf(out, "Digest diverges from golden at cycle %llu\n", (unsigned long long)hi);
+    } else {
+        // the marks are interval cycles apart, so which cycle in between is unknown
+        fprintf(out, "Digest diverges from golden within cycles %llu-%llu, a window rather than the first diverging\n"
+                "cycle: the golden is marked every %llu cycles (record it with -Z 1:file for the exact cycle)\n",
+                (unsigned long long)lo + 1, (unsigned long long)hi, (unsigned long long)interval);
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef PROCSIM_DIGEST_HPP
+#define PROCSIM_DIGEST_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "procsim.hpp"
+
+namespace procsim {
+
+// cycles between the marks of a digest file unless the caller picks its own
+#define DIGEST_INTERVAL 1024
+
+// the rolling hash as it stood at the end of a cycle
+typedef struct _digest_mark_t
+{
+    uint64_t cycle;
+    uint64_t hash;
+} digest_mark_t;
+
+// A rolling hash over a run: each retired instruction's (tag, fetch, disp,
+// sched, exec, state) row, and the machine state (fetched, fired, retired,
+// dispatch queue size, RS entries in use) after every cycle that changed it.
+// Rows of the same cycle are summed before they are folded in, so the order
+// instructions leave the RS in does not matter, and cycles that change
+// nothing are left out, so neither does fast-forwarding over idle cycles.
+//
+// The hash is marked every `interval` cycles and once more at the end of the
+// run. Given golden marks, each new mark is compared as it is made and the
+// first that differs is kept, which brackets the first diverging cycle to
+// within one interval (interval 1 finds it exactly).
+class RunDigest {
+public:
+    explicit RunDigest(uint64_t interval);
+
+    // compare against marks saved by an earlier run; the interval becomes
+    // theirs. Returns false (and says why) if path is unreadable.
+    bool load_golden(const char* path);
+    bool save(const char* path) const;
+
+    // starts a new run
+    void begin();
+    void instruction(uint64_t tag, const InstructionCycles& cycles) {
+        uint64_t h = mix(tag);
+        h = mix(h ^ cycles.fetch);
+        h = mix(h ^ cycles.dispatch);
+        h = mix(h ^ cycles.schedule);
+        h = mix(h ^ cycles.execute);
+        pending += mix(h ^ cycles.state_update);
+    }
+    void end_cycle(uint64_t cycle, uint64_t fetched, uint64_t fired, uint64_t retired,
+                   uint64_t dispatch_queue, uint64_t rs_used) {
+        uint64_t state[] = { fetched, fired, retired, dispatch_queue, rs_used };
+        if (memcmp(state, last_state, sizeof(state)) == 0) return;
+        fold(cycle, state);
+    }
+    // the run ended at the end of cycle
+    void finish(uint64_t cycle);
+
+    uint64_t hash() const { return rolling; }
+    const std::vector<digest_mark_t>& run_marks() const { return marks; }
+    bool verifying() const { return has_golden; }
+    // false once a mark differs from (or has no counterpart in) the golden
+    bool matches() const { return diverged == NO_MARK; }
+    // what was compared, and where the first divergence lies; quiet if
+    // there was no golden
+    void report(FILE* out) const;
+
+private:
+    static const size_t NO_MARK = SIZE_MAX;
+
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+    void fold(uint64_t cycle, const uint64_t state[5]);
+    void mark(uint64_t cycle);
+
+    uint64_t interval;
+    uint64_t rolling;
+    uint64_t pending;           // sum of this cycle's instruction hashes
+    uint64_t last_state[5];
+    uint64_t next_mark;
+    std::vector<digest_mark_t> marks;
+    bool has_golden;
+    std::vector<digest_mark_t> golden;
+    size_t diverged;            // index of the first mark that differs
+};
+
+} // namespace procsim
+
+#endif
@@ -1,11 +1,32 @@
+#include <algorithm>
 #include <cstdio>
 #include <cinttypes>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
+#include <getopt.h>
 #include <unistd.h>
 #include "procsim.hpp"
+#include "procsim_analyze.hpp"
+#include "procsim_interval.hpp"
+#include "procsim_pool.hpp"
+#include "procsim_sweep.hpp"
+#include "procsim_trace.hpp"
 
 FILE* inFile = stdin;
+// the decoder for inFile, picked from its header on first use
+procsim::InstructionSource* traceSource = NULL;
+// instructions read and decoded ahead on the prefetch thread
+size_t prefetchDepth = procsim::PrefetchSource::DEFAULT_DEPTH;
+
+static procsim::InstructionSource* open_trace_source(void) {
+    procsim::InstructionSource* source = procsim::open_trace(fileno(inFile), prefetchDepth);
+    if (source == NULL) {
+        exit(1);
+    }
+    return source;
+}
 
 void print_help_and_exit(void) {
     printf("procsim [OPTIONS]\n");
@@ -14,7 +35,41 @@ void print_help_and_exit(void) {
     printf("  -l k2\t\tNumber of k2 FUs\n");   
     printf("  -f N\t\tNumber of instructions to fetch\n");
     printf("  -r R\t\tNumber of result buses\n");
-    printf("  -i traces/file.trace\n");
+    printf("  -x L0,L1,L2\tExecute latency in cycles per FU type (default 1,1,1)\n");
+    printf("  -p P0,P1,P2\t1 = FU type is pipelined (default 0,0,0)\n");
+    printf("  -q N\t\tDispatch queue capacity; a full queue stalls fetch (default unbounded)\n");
+    printf("  -B policy\tResult bus arbitration: oldest (default) or fu:T,T,T (FU types, highest priority first)\n");
+    printf("  -A layout\tRS implementation: lists (default) or soa (bitmasks, SIMD wakeup)\n");
+    printf("  -i traces/file.trace\tText, .gz/.zst or binary (procsim-convert) trace, default stdin\n");
+    printf("\t\tRepeat -i to run the configuration (or each -S line) against every trace, print CSV\n");
+    printf("  -D N\t\tText trace prefetch depth in instructions; 0 reads on the simulation thread (default 65536)\n");
+    printf("  -S sweep.txt\tRun every \"R k0 k1 k2 F\" line of sweep.txt, print CSV\n");
+    printf("  -g IPC\t\tWith -S, skip configurations that cannot reach IPC (see --analyze)\n");
+    printf("  -a, --analyze\tReport op mix, dependency distances, critical path and ideal ILP,\n");
+    printf("\t\tcached in <trace>.analysis for later runs\n");
+    printf("  -u, --bound\tReport a lower bound on cycles (per -S line) instead of simulating;\n");
+    printf("\t\twith -E, also simulate and compare\n");
+    printf("  -t N\t\tWorker threads for -S and -P (default 1)\n");
+    printf("  -L level\tLogging: off, stats (output stats only) or events (default)\n");
+    printf("  -o file\tOutput file (default output.output)\n");
+    printf("  -e file\tEvent log file (default log.txt)\n");
+    printf("  -b\t\tWrite the event log in binary (see procsim-logdump)\n");
+    printf("  -T file\tWrite the timing table to file as binary columns (see procsim-logdump)\n");
+    printf("  -X\t\tAdd the pipeline counters (stalls, RS occupancy) to the output file\n");
+    printf("  -J file\tWrite the stats and pipeline counters as JSON to file\n");
+    printf("  -P K\t\tSimulate the trace as K intervals in parallel and stitch the stats\n");
+    printf("  -w N\t\tWarm-up instructions around each -P interval (default 10000)\n");
+    printf("  -E\t\tWith -P or -u, also run the exact sequential simulation and report the error\n");
+    printf("  -W N\t\tSkip the first N instructions untimed (functional warming)\n");
+    printf("  -c N:file\tStop at the end of cycle N and save a checkpoint to file\n");
+    printf("  -G N[:file]\tPrint a progress line (IPC, queue and RS occupancy, host speed) every N cycles,\n");
+    printf("\t\tor every N seconds as Ns, to stderr or file\n");
+    printf("  -Z [N:]file\tRecord a digest of every retired row and cycle's state to file, marked every\n");
+    printf("\t\tN cycles (default 1024)\n");
+    printf("  -z file\tCheck the run against a digest from -Z and report where it first diverges:\n");
+    printf("\t\tthe exact cycle only if the digest was recorded with -Z 1:file, else the\n");
+    printf("\t\tN-cycle window holding it\n");
+    printf("  -R file\tResume from a checkpoint of the same trace (replaces -r/-j/-k/-l/-f/-x/-p/-q/-B/-A)\n");
     printf("  -h\t\tThis helpful output\n");
     exit(0);
 }
@@ -26,20 +81,61 @@ void print_help_and_exit(void) {
 //
 bool read_instruction(proc_inst_t* p_inst)
 {
-    int ret;
-    
     if (p_inst == NULL)
     {
         fprintf(stderr, "Fetch requires a valid pointer to populate\n");
         return false;
     }
-    
-    ret = fscanf(stdin, "%x %d %d %d %d\n", &p_inst->instruction_address,
-                 &p_inst->op_code, &p_inst->dest_reg, &p_inst->src_reg[0], &p_inst->src_reg[1]); 
-    if (ret != 5) {
+
+    return read_instructions(p_inst, 1) == 1;
+}
+
+//
+// read_instructions
+//
+//  returns the number of instructions read into buf, less than n only at the
+//  end of the trace
+//
+size_t read_instructions(proc_inst_t* buf, size_t n)
+{
+    if (traceSource == NULL) {
+        traceSource = open_trace_source();
+    }
+    return traceSource->read(buf, n);
+}
+
+// the analysis of the -i trace (path, NULL for stdin) from its sidecar when
+// that is current; otherwise decodes the trace into trace, unless *decoded
+// says it already is, analyzes it and updates the sidecar
+static void get_analysis(const char* path, std::vector<proc_inst_t>& trace, bool* decoded,
+                         trace_analysis_t* p_analysis) {
+    if (path != NULL && load_analysis(path, p_analysis)) {
+        return;
+    }
+    if (!*decoded) {
+        procsim::ReadInstructionSource source;
+        load_trace(source, trace);
+        *decoded = true;
+    }
+    analyze_trace(trace, p_analysis);
+    if (path != NULL) {
+        save_analysis(path, *p_analysis);
+    }
+}
+
+// the configurations to run: every line of sweep_file, or machine itself
+// without one. Either way they take all but R/k0/k1/k2/F from machine, so
+// an option added to sweep_config_t reaches every mode built from it.
+static bool build_configs(const char* sweep_file, const sweep_config_t& machine,
+                          std::vector<sweep_config_t>& configs) {
+    if (sweep_file == NULL) {
+        configs.push_back(machine);
+        return true;
+    }
+    if (!parse_sweep_file(sweep_file, configs)) {
         return false;
     }
-    
+    apply_machine_options(machine, configs);
     return true;
 }
 
@@ -52,9 +148,42 @@ int main(int argc, char* argv[]) {
     uint64_t k1 = DEFAULT_K1;
     uint64_t k2 = DEFAULT_K2;
     uint64_t r = DEFAULT_R;
+    const char* sweep_file = NULL;
+    std::vector<std::string> trace_paths;
+    bool analyze = false;
+    bool bound = false;
+    double target_ipc = 0.0;
+    unsigned threads = 1;
+    interval_options_t interval_options = { 0, 10000, 1 };
+    bool interval_exact = false;
+    uint64_t warm_count = 0;
+    uint64_t checkpoint_cycle = 0;
+    const char* checkpoint_file = NULL;
+    const char* restore_file = NULL;
+    progress_options_t progress_options = { 0, 0.0, NULL };
+    digest_options_t digest_options = { NULL, false, 0 };
+    char* end;
+    // options that only shape a single simulated run, as given
+    std::string single_run_options;
+    output_options_t output_options = { LOG_EVENTS, "output.output", "log.txt", false, false, NULL, NULL };
+    // R, k0, k1, k2 and F are filled in once the options are read
+    sweep_config_t machine = { 0, 0, 0, 0, 0, {}, 0, { BUS_OLDEST_FIRST, { 0, 1, 2 } }, RS_LAYOUT_LISTS };
+    for (int t = 0; t < FU_TYPES; t++) {
+        machine.timing.latency[t] = DEFAULT_FU_LATENCY;
+        machine.timing.pipelined[t] = false;
+    }
+
+    static const struct option long_options[] = {
+        { "analyze", no_argument, NULL, 'a' },
+        { "bound", no_argument, NULL, 'u' },
+        { NULL, 0, NULL, 0 }
+    };
 
     /* Read arguments */ 
-    while(-1 != (opt = getopt(argc, argv, "r:i:j:k:l:f:h"))) {
+    while(-1 != (opt = getopt_long(argc, argv, "r:i:D:j:k:l:f:x:p:q:B:A:S:g:aut:P:w:EL:o:e:bT:XJ:W:c:R:G:Z:z:h", long_options, NULL))) {
+        if (opt != '?' && strchr("WcRGZzLoebTXJ", opt) != NULL) {
+            single_run_options += std::string(single_run_options.empty() ? "-" : ", -") + (char)opt;
+        }
         switch(opt) {
         case 'r':
             r = atoi(optarg);
@@ -71,7 +200,18 @@ int main(int argc, char* argv[]) {
         case 'f':
             f = atoi(optarg);
             break;
+        case 'x':
+        case 'p':
+        case 'q':
+        case 'B':
+        case 'A':
+            if (!parse_machine_option(opt, optarg, &machine)) {
+                print_help_and_exit();
+            }
+            break;
         case 'i':
+            trace_paths.push_back(optarg);
+            if (trace_paths.size() > 1) break;
             inFile = fopen(optarg, "r");
             if (inFile == NULL)
             {
@@ -79,6 +219,108 @@ int main(int argc, char* argv[]) {
                 print_help_and_exit();
             }
             break;
+        case 'D':
+            prefetchDepth = strtoull(optarg, NULL, 10);
+            break;
+        case 'S':
+            sweep_file = optarg;
+            break;
+        case 'g':
+            target_ipc = atof(optarg);
+            break;
+        case 'a':
+            analyze = true;
+            break;
+        case 'u':
+            bound = true;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'P':
+            interval_options.intervals = strtoull(optarg, NULL, 10);
+            break;
+        case 'w':
+            interval_options.warmup = strtoull(optarg, NULL, 10);
+            break;
+        case 'E':
+            interval_exact = true;
+            break;
+        case 'L':
+            if (strcmp(optarg, "off") == 0) {
+                output_options.level = LOG_OFF;
+            } else if (strcmp(optarg, "stats") == 0) {
+                output_options.level = LOG_STATS;
+            } else if (strcmp(optarg, "events") == 0) {
+                output_options.level = LOG_EVENTS;
+            } else {
+                print_help_and_exit();
+            }
+            break;
+        case 'o':
+            output_options.output_path = optarg;
+            break;
+        case 'e':
+            output_options.log_path = optarg;
+            break;
+        case 'b':
+            output_options.binary_log = true;
+            break;
+        case 'T':
+            output_options.timing_path = optarg;
+            break;
+        case 'X':
+            output_options.extended_stats = true;
+            break;
+        case 'J':
+            output_options.json_path = optarg;
+            break;
+        case 'W':
+            warm_count = strtoull(optarg, NULL, 10);
+            break;
+        case 'c':
+            checkpoint_cycle = strtoull(optarg, &end, 10);
+            if (end == optarg || *end != ':' || end[1] == '\0') {
+                print_help_and_exit();
+            }
+            checkpoint_file = end + 1;
+            break;
+        case 'R':
+            restore_file = optarg;
+            break;
+        case 'G':
+            progress_options.cycles = strtoull(optarg, &end, 10);
+            if (*end == 's' || *end == '.') {
+                progress_options.cycles = 0;
+                progress_options.seconds = strtod(optarg, &end);
+                if (*end != 's') {
+                    print_help_and_exit();
+                }
+                end++;
+            }
+            if (end == optarg || (*end != ':' && *end != '\0') || (*end == ':' && end[1] == '\0')) {
+                print_help_and_exit();
+            }
+            progress_options.path = *end == ':' ? end + 1 : NULL;
+            break;
+        case 'Z':
+            digest_options.verify = false;
+            digest_options.interval = strtoull(optarg, &end, 10);
+            digest_options.path = optarg;
+            if (end != optarg && *end == ':') {
+                digest_options.path = end + 1;
+                if (digest_options.interval == 0 || *digest_options.path == '\0') {
+                    print_help_and_exit();
+                }
+            } else {
+                digest_options.interval = 0;
+            }
+            break;
+        case 'z':
+            digest_options.verify = true;
+            digest_options.interval = 0;
+            digest_options.path = optarg;
+            break;
         case 'h':
             /* Fall through */
         default:
@@ -87,6 +329,16 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    if (r == 0 || f == 0 || k0 + k1 + k2 == 0) {
+        fprintf(stderr, "-r and -f must be at least 1, and -j + -k + -l at least 1\n");
+        return 1;
+    }
+    machine.r = r;
+    machine.k0 = k0;
+    machine.k1 = k1;
+    machine.k2 = k2;
+    machine.f = f;
+
     // printf("Processor Settings\n");
     // printf("R: %" PRIu64 "\n", r);
     // printf("k0: %" PRIu64 "\n", k0);
@@ -95,25 +347,203 @@ int main(int argc, char* argv[]) {
     // printf("F: %"  PRIu64 "\n", f);
     // printf("\n");
 
+    if (analyze) {
+        procsim::TraceCache cache;
+        for (size_t i = 0; i < std::max(trace_paths.size(), (size_t)1); i++) {
+            trace_analysis_t analysis;
+            if (trace_paths.empty()) {
+                std::vector<proc_inst_t> trace;
+                procsim::ReadInstructionSource source;
+                load_trace(source, trace);
+                analyze_trace(trace, &analysis);
+            } else if (!load_analysis(trace_paths[i].c_str(), &analysis)) {
+                std::shared_ptr<const decoded_trace_t> trace = cache.acquire(trace_paths[i]);
+                if (!trace) return 1;
+                analyze_trace(*trace, &analysis);
+                save_analysis(trace_paths[i].c_str(), analysis);
+            }
+            if (trace_paths.size() > 1) printf("%sTrace: %s\n", i ? "\n" : "", trace_paths[i].c_str());
+            print_analysis(stdout, analysis);
+        }
+        return 0;
+    }
+
+    // the modes below run many simulations, or none, and would ignore these
+    const char* batch_mode = NULL;
+    if (sweep_file != NULL) batch_mode = "-S";
+    else if (interval_options.intervals > 0) batch_mode = "-P";
+    else if (trace_paths.size() > 1) batch_mode = "Several -i traces";
+    else if (bound) batch_mode = "-u";
+    if (batch_mode != NULL && !single_run_options.empty()) {
+        fprintf(stderr, "%s cannot be combined with the single-run options %s\n", batch_mode,
+                single_run_options.c_str());
+        return 1;
+    }
+    if (target_ipc > 0.0 && sweep_file == NULL) {
+        fprintf(stderr, "-g needs -S\n");
+        return 1;
+    }
+    if (sweep_file != NULL && interval_options.intervals > 0) {
+        fprintf(stderr, "-S cannot be combined with -P\n");
+        return 1;
+    }
+
+    if (trace_paths.size() > 1) {
+        if (interval_options.intervals > 0) {
+            fprintf(stderr, "Several -i traces cannot be combined with -P\n");
+            return 1;
+        }
+        if (target_ipc > 0.0 || bound) {
+            fprintf(stderr, "-g and -u need a single -i trace\n");
+            return 1;
+        }
+        std::vector<sweep_config_t> configs;
+        if (!build_configs(sweep_file, machine, configs)) {
+            return 1;
+        }
+
+        /* Decode every trace once, then replay it for every configuration */
+        procsim::TraceCache cache;
+        return run_trace_sweep(cache, trace_paths, configs, threads, stdout) ? 0 : 1;
+    }
+
+    if (bound) {
+        std::vector<sweep_config_t> configs;
+        if (!build_configs(sweep_file, machine, configs)) {
+            return 1;
+        }
+
+        /* A current sidecar answers without reading the trace at all */
+        std::vector<proc_inst_t> trace;
+        bool decoded = false;
+        trace_analysis_t analysis;
+        get_analysis(trace_paths.empty() ? NULL : trace_paths[0].c_str(), trace, &decoded, &analysis);
+
+        std::vector<proc_stats_t> exact;
+        std::vector<char> stuck;
+        if (interval_exact) {
+            if (!decoded) {
+                procsim::ReadInstructionSource source;
+                load_trace(source, trace);
+            }
+            exact.resize(configs.size());
+            stuck.assign(configs.size(), false);
+            procsim::WorkStealingPool pool(threads);
+            pool.run(configs.size(), [&](size_t job) {
+                stuck[job] = !simulate_config(trace, configs[job], &exact[job]);
+            });
+        }
+
+        bool ok = true;
+        print_bound_header(stdout, interval_exact);
+        for (size_t i = 0; i < configs.size(); i++) {
+            if (interval_exact && stuck[i]) {
+                report_deadlock(configs[i]);
+                ok = false;
+                continue;
+            }
+            print_bound_row(stdout, analysis, configs[i], interval_exact ? &exact[i] : NULL);
+        }
+        return ok ? 0 : 1;
+    }
+
+    /* The trace format is picked from the file header */
+    traceSource = open_trace_source();
+
+    if (sweep_file != NULL) {
+        std::vector<sweep_config_t> configs;
+        if (!build_configs(sweep_file, machine, configs)) {
+            return 1;
+        }
+
+        /* Parse the trace once, then replay it for every configuration */
+        std::vector<proc_inst_t> trace;
+        procsim::ReadInstructionSource source;
+        load_trace(source, trace);
+        if (target_ipc > 0.0) {
+            bool decoded = true;
+            trace_analysis_t analysis;
+            get_analysis(trace_paths.empty() ? NULL : trace_paths[0].c_str(), trace, &decoded, &analysis);
+            size_t total = configs.size();
+            size_t pruned = prune_configs(analysis, target_ipc, configs);
+            fprintf(stderr, "Skipped %llu of %llu configurations that cannot reach IPC %f\n",
+                    (unsigned long long)pruned, (unsigned long long)total, target_ipc);
+        }
+        return run_sweep(trace, configs, threads, stdout) ? 0 : 1;
+    }
+
+    if (interval_options.intervals > 0) {
+        interval_options.threads = threads;
+
+        std::vector<proc_inst_t> trace;
+        procsim::ReadInstructionSource source;
+        load_trace(source, trace);
+
+        std::vector<interval_result_t> results;
+        proc_stats_t stitched, exact;
+        if (!run_intervals(trace, machine, interval_options, results, interval_exact ? &exact : NULL)) {
+            fprintf(stderr, "The pipeline deadlocked; no interval report\n");
+            return 1;
+        }
+        stitch_intervals(results, &stitched);
+        print_interval_report(stdout, interval_options, results, stitched, interval_exact ? &exact : NULL);
+        return 0;
+    }
+
+    if (digest_options.path != NULL && (checkpoint_file != NULL || restore_file != NULL)) {
+        fprintf(stderr, "-Z and -z cover a whole run and cannot be combined with -c or -R\n");
+        return 1;
+    }
+
     /* Setup the processor */
-    setup_proc(r, k0, k1, k2, f);
+    set_output_options(&output_options);
+    set_progress(&progress_options);
+    if (!set_digest(&digest_options)) {
+        return 1;
+    }
+    set_fu_timing(&machine.timing);
+    set_dispatch_limit(machine.dispatch_limit);
+    set_bus_arbitration(&machine.bus_arbitration);
+    set_rs_layout(machine.rs_layout);
+    if (restore_file != NULL) {
+        if (!restore_checkpoint(restore_file)) {
+            return 1;
+        }
+    } else {
+        setup_proc(r, k0, k1, k2, f);
+    }
+    if (warm_count > 0) {
+        warm_proc(warm_count);
+    }
 
     /* Setup statistics */
     proc_stats_t stats;
     memset(&stats, 0, sizeof(proc_stats_t));
 
     /* Run the processor */
-    run_proc(&stats);
+    if (checkpoint_file != NULL) {
+        run_proc_until(checkpoint_cycle);
+        if (proc_deadlocked() || !save_checkpoint(checkpoint_file)) {
+            return 1;
+        }
+    } else {
+        run_proc(&stats);
+    }
 
     /* Finalize stats */
     complete_proc(&stats);
+    if (proc_deadlocked()) {
+        // the stats cover only the cycles before it stuck
+        return 1;
+    }
+    bool digest_ok = finish_digest();
 
     // Comment this out when submitting to gradescope
     // print_statistics(&stats);
 
     printf("%lu\n",stats.cycle_count);
 
-    return 0;
+    return digest_ok ? 0 : 1;
 }
 
 void print_statistics(proc_stats_t* p_stats) {
@@ -0,0 +1,155 @@
+#include "procsim_interval.hpp"
+#include "procsim_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+using namespace procsim;
+
+// steps a cycle at a time until `target` instructions have retired; if
+// max_disp is given, raises it to the largest dispatch queue seen on the way
+static void run_to_retired(Core& core, uint64_t target, proc_counters_t* at, uint64_t* max_disp)
+{
+    core.read_counters(at);
+    proc_counters_t prev = *at;
+    while (at->retired < target && core.run_until(at->cycles + 1)) {
+        core.read_counters(at);
+        // the queue size is summed once per cycle, and is constant over skipped ones
+        if (max_disp && at->cycles > prev.cycles) {
+            *max_disp = std::max(*max_disp, (at->total_disp_size - prev.total_disp_size) / (at->cycles - prev.cycles));
+        }
+        prev = *at;
+    }
+    core.read_counters(at);
+    if (max_disp && at->cycles > prev.cycles) {
+        *max_disp = std::max(*max_disp, (at->total_disp_size - prev.total_disp_size) / (at->cycles - prev.cycles));
+    }
+}
+
+// false if the core deadlocked
+static bool simulate_interval(const std::vector<proc_inst_t>& trace, const sweep_config_t& config,
+                              uint64_t warmup, bool last, interval_result_t* result)
+{
+    uint64_t begin = result->first - std::min(result->first, warmup);
+    uint64_t end = result->first + result->count;
+    if (!last) end = std::min((uint64_t)trace.size(), end + warmup);
+
+    ArraySource source(trace.data() + begin, end - begin);
+    Core core(&source, NULL, NULL);
+    setup_config(core, config);
+
+    // the counted window runs from the cycle the warm-up has retired to the
+    // cycle the chunk has; everything fired or retired in it is counted,
+    // whichever instruction it belongs to
+    proc_counters_t start, stop;
+    uint64_t max_disp = 0;
+    run_to_retired(core, result->first - begin, &start, NULL);
+    run_to_retired(core, result->first - begin + result->count, &stop, &max_disp);
+
+    result->delta.cycles = stop.cycles - start.cycles;
+    result->delta.retired = stop.retired - start.retired;
+    result->delta.fired = stop.fired - start.fired;
+    result->delta.total_disp_size = stop.total_disp_size - start.total_disp_size;
+    result->delta.max_disp_size = max_disp;
+    return !core.deadlocked();
+}
+
+bool run_intervals(const std::vector<proc_inst_t>& trace, const sweep_config_t& config,
+                   const interval_options_t& options, std::vector<interval_result_t>& results,
+                   proc_stats_t* exact)
+{
+    uint64_t intervals = std::max((uint64_t)1, std::min(options.intervals, (uint64_t)trace.size()));
+    results.assign(intervals, interval_result_t());
+    for (uint64_t i = 0; i < intervals; i++) {
+        results[i].first = trace.size() * i / intervals;
+        results[i].count = trace.size() * (i + 1) / intervals - results[i].first;
+    }
+
+    // the exact run, being the longest job, goes first
+    size_t jobs = results.size() + (exact ? 1 : 0);
+    std::atomic<bool> ok(true);
+    WorkStealingPool pool(options.threads);
+    pool.run(jobs, [&](size_t job) {
+        if (exact && job == 0) {
+            if (!simulate_config(trace, config, exact)) ok = false;
+            return;
+        }
+        size_t i = exact ? job - 1 : job;
+        if (!simulate_interval(trace, config, options.warmup, i + 1 == results.size(), &results[i])) ok = false;
+    });
+    return ok;
+}
+
+void stitch_intervals(const std::vector<interval_result_t>& results, proc_stats_t* p_stats)
+{
+    proc_counters_t total;
+    memset(&total, 0, sizeof(total));
+    for (auto& result : results) {
+        total.cycles += result.delta.cycles;
+        total.retired += result.delta.retired;
+        total.fired += result.delta.fired;
+        total.total_disp_size += result.delta.total_disp_size;
+        total.max_disp_size = std::max(total.max_disp_size, result.delta.max_disp_size);
+    }
+
+    memset(p_stats, 0, sizeof(proc_stats_t));
+    // the window edges fall on whole cycles, so the measured retirements
+    // need not add up to the trace; the total is the chunks themselves
+    p_stats->retired_instruction = 0;
+    for (auto& result : results) {
+        p_stats->retired_instruction += result.count;
+    }
+    p_stats->cycle_count = total.cycles;
+    p_stats->max_disp_size = total.max_disp_size;
+    if (total.cycles > 0) {
+        p_stats->avg_inst_retired = (double)total.retired / (double)total.cycles;
+        p_stats->avg_inst_fired = (double)total.fired / (double)total.cycles;
+        p_stats->avg_disp_size = (double)total.total_disp_size / (double)total.cycles;
+    }
+}
+
+// signed relative error in percent
+static double error_pct(double estimate, double exact)
+{
+    if (exact == 0.0) return 0.0;
+    return 100.0 * (estimate - exact) / exact;
+}
+
+void print_interval_report(FILE* out, const interval_options_t& options,
+                           const std::vector<interval_result_t>& results,
+                           const proc_stats_t& stitched, const proc_stats_t* exact)
+{
+    fprintf(out, "Intervals: %llu, warm-up: %llu instructions\n",
+            (unsigned long long)results.size(), (unsigned long long)options.warmup);
+    fprintf(out, "INTERVAL\tFIRST\tCOUNT\tCYCLES\tIPC\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const interval_result_t& result = results[i];
+        fprintf(out, "%llu\t%llu\t%llu\t%llu\t%f\n", (unsigned long long)i,
+                (unsigned long long)result.first + 1, (unsigned long long)result.count,
+                (unsigned long long)result.delta.cycles,
+                result.delta.cycles ? (double)result.delta.retired / (double)result.delta.cycles : 0.0);
+    }
+
+    fprintf(out, "\nStitched stats:\n");
+    fprintf(out, "Total instructions: %lu\n", stitched.retired_instruction);
+    fprintf(out, "Avg Dispatch queue size: %f\n", stitched.avg_disp_size);
+    fprintf(out, "Maximum Dispatch queue size: %lu\n", stitched.max_disp_size);
+    fprintf(out, "Avg inst fired per cycle: %f\n", stitched.avg_inst_fired);
+    fprintf(out, "Avg inst retired per cycle: %f\n", stitched.avg_inst_retired);
+    fprintf(out, "Total run time (cycles): %lu\n", stitched.cycle_count);
+    if (exact == NULL) {
+        return;
+    }
+
+    fprintf(out, "\nError vs sequential run:\n");
+    fprintf(out, "Avg Dispatch queue size: %f (%+.3f%%)\n", exact->avg_disp_size,
+            error_pct(stitched.avg_disp_size, exact->avg_disp_size));
+    fprintf(out, "Maximum Dispatch queue size: %lu (%+.3f%%)\n", exact->max_disp_size,
+            error_pct(stitched.max_disp_size, exact->max_disp_size));
+    fprintf(out, "Avg inst fired per cycle: %f (%+.3f%%)\n", exact->avg_inst_fired,
+            error_pct(stitched.avg_inst_fired, exact->avg_inst_fired));
+    fprintf(out, "Avg inst retired per cycle: %f (%+.3f%%)\n", exact->avg_inst_retired,
+            error_pct(stitched.avg_inst_retired, exact->avg_inst_retired));
+    fprintf(out, "Total run time (cycles): %lu (%+.3f%%)\n", exact->cycle_count,
+            error_pct(stitched.cycle_count, exact->cycle_count));
+}
@@ -0,0 +1,46 @@
+#ifndef PROCSIM_INTERVAL_HPP
+#define PROCSIM_INTERVAL_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "procsim.hpp"
+#include "procsim_sweep.hpp"
+
+// Interval-parallel simulation: the trace is cut into equal chunks that run
+// on separate cores at once. Each chunk is preceded by `warmup` instructions
+// to fill the RS, register state and dispatch queue the way the previous
+// chunk would have, and (except the last) followed by as many so it does not
+// end in an artificial drain. Only the cycles between the chunk's first and
+// last retirement are counted.
+typedef struct _interval_options_t
+{
+    uint64_t intervals;
+    uint64_t warmup;        // instructions simulated on each side of a chunk
+    unsigned threads;
+} interval_options_t;
+
+// counted part of one chunk
+typedef struct _interval_result_t
+{
+    uint64_t first;         // first instruction of the chunk
+    uint64_t count;
+    proc_counters_t delta;  // counters over the chunk's counted cycles only
+} interval_result_t;
+
+// exact may be NULL; otherwise the full sequential run is simulated as one
+// more job on the same pool. False if any run deadlocked, leaving the
+// results meaningless.
+bool run_intervals(const std::vector<proc_inst_t>& trace, const sweep_config_t& config,
+                   const interval_options_t& options, std::vector<interval_result_t>& results,
+                   proc_stats_t* exact);
+
+// sums the chunks into a whole-run estimate
+void stitch_intervals(const std::vector<interval_result_t>& results, proc_stats_t* p_stats);
+
+// per-chunk rows, the stitched stats and, when exact is given, relative errors
+void print_interval_report(FILE* out, const interval_options_t& options,
+                           const std::vector<interval_result_t>& results,
+                           const proc_stats_t& stitched, const proc_stats_t* exact);
+
+#endif
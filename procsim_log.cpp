@@ -0,0 +1,127 @@
+#include "procsim_log.hpp"
+#include <algorithm>
+#include <cstring>
+
+using namespace procsim;
+
+static const char* const STAGE_NAMES[EVENT_STAGE_COUNT] = {
+    "FETCHED", "DISPATCHED", "SCHEDULED", "EXECUTED", "STATE UPDATE"
+};
+
+const char* event_stage_name(int stage)
+{
+    return (stage >= 0 && stage < EVENT_STAGE_COUNT) ? STAGE_NAMES[stage] : "UNKNOWN";
+}
+
+void print_event(FILE* out, uint64_t cycle, int stage, uint64_t tag)
+{
+    fprintf(out, "%llu\t%s\t%llu\n", (unsigned long long)cycle, event_stage_name(stage),
+            (unsigned long long)(tag + 1));
+}
+
+void TextEventLog::begin()
+{
+    fprintf(out, "CYCLE\tOPERATION\tINSTRUCTION\n");
+}
+
+void TextEventLog::event(uint64_t cycle, event_stage_t stage, uint64_t tag)
+{
+    print_event(out, cycle, stage, tag);
+}
+
+void TextEventLog::flush()
+{
+    fflush(out);
+}
+
+BinaryEventLog::BinaryEventLog(FILE* out)
+    : out(out), buffer(BUFFER_RECORDS), used(0)
+{
+}
+
+BinaryEventLog::~BinaryEventLog()
+{
+    flush();
+}
+
+void BinaryEventLog::begin()
+{
+    fwrite(EVENT_LOG_MAGIC, 1, EVENT_LOG_MAGIC_LEN, out);
+}
+
+void BinaryEventLog::flush()
+{
+    if (used > 0) {
+        fwrite(buffer.data(), sizeof(event_record_t), used, out);
+        used = 0;
+    }
+    fflush(out);
+}
+
+ColumnarTimingLog::ColumnarTimingLog(FILE* out)
+    : out(out), columns(TIMING_COLUMNS * TIMING_BLOCK_ROWS), packed(4 * TIMING_BLOCK_ROWS), last_fetch(0)
+{
+    memset(&block, 0, sizeof(block));
+}
+
+ColumnarTimingLog::~ColumnarTimingLog()
+{
+    flush();
+}
+
+void ColumnarTimingLog::begin()
+{
+    fwrite(TIMING_TABLE_MAGIC, 1, TIMING_TABLE_MAGIC_LEN, out);
+    memset(&block, 0, sizeof(block));
+}
+
+void ColumnarTimingLog::row(uint64_t tag, const uint64_t cycles[TIMING_COLUMNS])
+{
+    if (block.rows == TIMING_BLOCK_ROWS || (block.rows > 0 && tag != block.first_tag + block.rows)) {
+        write_block();
+    }
+    if (block.rows == 0) {
+        block.first_tag = tag;
+        block.fetch_base = cycles[0];
+        last_fetch = cycles[0];
+    }
+
+    // stage cycles never decrease along a row, nor fetch cycles down the table
+    uint32_t i = block.rows++;
+    columns[i] = (uint32_t)(cycles[0] - last_fetch);
+    for (int c = 1; c < TIMING_COLUMNS; c++) {
+        columns[c * TIMING_BLOCK_ROWS + i] = (uint32_t)(cycles[c] - cycles[c - 1]);
+    }
+    last_fetch = cycles[0];
+}
+
+void ColumnarTimingLog::write_block()
+{
+    if (block.rows == 0) {
+        return;
+    }
+    const uint32_t* column[TIMING_COLUMNS];
+    for (int c = 0; c < TIMING_COLUMNS; c++) {
+        column[c] = &columns[c * TIMING_BLOCK_ROWS];
+        uint32_t widest = *std::max_element(column[c], column[c] + block.rows);
+        block.width[c] = widest < (1u << 8) ? 1 : widest < (1u << 16) ? 2 : 4;
+    }
+    fwrite(&block, sizeof(block), 1, out);
+
+    for (int c = 0; c < TIMING_COLUMNS; c++) {
+        uint8_t* p = packed.data();
+        for (uint32_t i = 0; i < block.rows; i++) {
+            for (int b = 0; b < block.width[c]; b++) {
+                *p++ = (uint8_t)(column[c][i] >> (8 * b));
+            }
+        }
+        fwrite(packed.data(), block.width[c], block.rows, out);
+    }
+    block.rows = 0;
+}
+
+void ColumnarTimingLog::flush()
+{
+    write_block();
+    fflush(out);
+}
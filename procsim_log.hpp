@@ -0,0 +1,124 @@
+#ifndef PROCSIM_LOG_HPP
+#define PROCSIM_LOG_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Pipeline events, in the order the text log names them
+typedef enum _event_stage_t
+{
+    EVENT_FETCHED = 0,
+    EVENT_DISPATCHED,
+    EVENT_SCHEDULED,
+    EVENT_EXECUTED,
+    EVENT_STATE_UPDATE,
+    EVENT_STAGE_COUNT
+} event_stage_t;
+
+// Binary event log layout: EVENT_LOG_MAGIC followed by event_record_t entries.
+// The stage is kept in the top byte of tag_stage, the tag in the low 56 bits.
+#define EVENT_LOG_MAGIC "PSIMLOG\x01"
+#define EVENT_LOG_MAGIC_LEN 8
+#define EVENT_TAG_BITS 56
+
+typedef struct _event_record_t
+{
+    uint64_t cycle;
+    uint64_t tag_stage;
+} event_record_t;
+
+// Columnar timing table: TIMING_TABLE_MAGIC, then blocks of up to
+// TIMING_BLOCK_ROWS consecutive tags. Each block is a timing_block_t and
+// five columns of `rows` little-endian unsigned values each, for FETCH,
+// DISP, SCHED, EXEC and STATE; column c is width[c] (1, 2 or 4) bytes per
+// value, the narrowest that holds its largest value in the block. FETCH is
+// the delta from the previous row's fetch cycle (the block's fetch_base for
+// its first row); each other stage is the delta from the stage before it in
+// the same row. A gap in tags (functional warming) starts a new block.
+#define TIMING_TABLE_MAGIC "PSIMTIM\x01"
+#define TIMING_TABLE_MAGIC_LEN 8
+#define TIMING_COLUMNS 5
+#define TIMING_BLOCK_ROWS (1 << 16)
+
+typedef struct _timing_block_t
+{
+    uint64_t first_tag;     // 0-indexed; INST prints it plus one
+    uint64_t fetch_base;
+    uint32_t rows;
+    uint8_t width[TIMING_COLUMNS];
+    uint8_t reserved[7];
+} timing_block_t;
+
+const char* event_stage_name(int stage);
+
+// the line the text log has always used for an event (tags print 1-indexed)
+void print_event(FILE* out, uint64_t cycle, int stage, uint64_t tag);
+
+namespace procsim {
+
+// Where a core reports per-instruction pipeline events
+class EventLog {
+public:
+    virtual ~EventLog() {}
+    virtual void begin() = 0;
+    virtual void event(uint64_t cycle, event_stage_t stage, uint64_t tag) = 0;
+    virtual void flush() = 0;
+};
+
+// the CYCLE/OPERATION/INSTRUCTION text format of log.txt
+class TextEventLog : public EventLog {
+public:
+    explicit TextEventLog(FILE* out) : out(out) {}
+    void begin();
+    void event(uint64_t cycle, event_stage_t stage, uint64_t tag);
+    void flush();
+private:
+    FILE* out;
+};
+
+// fixed-size event_record_t entries collected in a large buffer;
+// procsim-logdump renders them back into the text format
+class BinaryEventLog : public EventLog {
+public:
+    static const size_t BUFFER_RECORDS = 1 << 16;
+
+    explicit BinaryEventLog(FILE* out);
+    ~BinaryEventLog();
+    void begin();
+    void event(uint64_t cycle, event_stage_t stage, uint64_t tag) {
+        if (used == buffer.size()) flush();
+        buffer[used].cycle = cycle;
+        buffer[used].tag_stage = ((uint64_t)stage << EVENT_TAG_BITS) | tag;
+        used++;
+    }
+    void flush();
+private:
+    FILE* out;
+    std::vector<event_record_t> buffer;
+    size_t used;
+};
+
+// Writes the INST/FETCH/DISP/SCHED/EXEC/STATE table in the columnar
+// format, a block at a time; procsim-logdump renders it back as text
+class ColumnarTimingLog {
+public:
+    explicit ColumnarTimingLog(FILE* out);
+    ~ColumnarTimingLog();
+    void begin();
+    // rows must arrive in tag order
+    void row(uint64_t tag, const uint64_t cycles[TIMING_COLUMNS]);
+    void flush();
+private:
+    void write_block();
+
+    FILE* out;
+    std::vector<uint32_t> columns;  // column c of row i at c * TIMING_BLOCK_ROWS + i
+    std::vector<uint8_t> packed;
+    timing_block_t block;
+    uint64_t last_fetch;
+};
+
+} // namespace procsim
+
+#endif
@@ -0,0 +1,95 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "procsim_log.hpp"
+
+//
+// procsim-logdump
+//
+//  renders a binary event log (procsim -b) in the text log.txt format, or a
+//  columnar timing table (procsim -T) as the output file's INST..STATE table
+//
+
+// true if the whole table was read
+static bool dump_timing_table(FILE* in)
+{
+    printf("INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n");
+    std::vector<uint32_t> columns(TIMING_COLUMNS * TIMING_BLOCK_ROWS);
+    std::vector<uint8_t> packed(4 * TIMING_BLOCK_ROWS);
+    timing_block_t block;
+    while (fread(&block, sizeof(block), 1, in) == 1) {
+        if (block.rows > TIMING_BLOCK_ROWS) return false;
+        for (int c = 0; c < TIMING_COLUMNS; c++) {
+            int width = block.width[c];
+            if (width != 1 && width != 2 && width != 4) return false;
+            if (fread(packed.data(), width, block.rows, in) != block.rows) return false;
+            const uint8_t* p = packed.data();
+            for (uint32_t i = 0; i < block.rows; i++) {
+                uint32_t value = 0;
+                for (int b = 0; b < width; b++) {
+                    value |= (uint32_t)*p++ << (8 * b);
+                }
+                columns[c * TIMING_BLOCK_ROWS + i] = value;
+            }
+        }
+
+        uint64_t fetch = block.fetch_base;
+        for (uint32_t i = 0; i < block.rows; i++) {
+            uint64_t cycles[TIMING_COLUMNS];
+            fetch += columns[i];
+            cycles[0] = fetch;
+            for (int c = 1; c < TIMING_COLUMNS; c++) {
+                cycles[c] = cycles[c - 1] + columns[c * TIMING_BLOCK_ROWS + i];
+            }
+            printf("%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n", (unsigned long long)(block.first_tag + i + 1),
+                   (unsigned long long)cycles[0], (unsigned long long)cycles[1], (unsigned long long)cycles[2],
+                   (unsigned long long)cycles[3], (unsigned long long)cycles[4]);
+        }
+    }
+    return feof(in);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: procsim-logdump events.bin > log.txt\n");
+        fprintf(stderr, "       procsim-logdump timing.bin > table.txt\n");
+        return 1;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Failed to open %s for reading\n", argv[1]);
+        return 1;
+    }
+
+    char magic[EVENT_LOG_MAGIC_LEN];
+    bool read_magic = fread(magic, 1, sizeof(magic), in) == sizeof(magic);
+    if (read_magic && memcmp(magic, TIMING_TABLE_MAGIC, TIMING_TABLE_MAGIC_LEN) == 0) {
+        bool ok = dump_timing_table(in);
+        fclose(in);
+        if (!ok) {
+            fprintf(stderr, "%s is truncated\n", argv[1]);
+            return 1;
+        }
+        return 0;
+    }
+    if (!read_magic || memcmp(magic, EVENT_LOG_MAGIC, EVENT_LOG_MAGIC_LEN) != 0) {
+        fprintf(stderr, "%s is not a binary event log or timing table\n", argv[1]);
+        return 1;
+    }
+
+    printf("CYCLE\tOPERATION\tINSTRUCTION\n");
+    const uint64_t tag_mask = (1ULL << EVENT_TAG_BITS) - 1;
+    event_record_t records[4096];
+    size_t got;
+    while ((got = fread(records, sizeof(event_record_t), 4096, in)) > 0) {
+        for (size_t i = 0; i < got; i++) {
+            print_event(stdout, records[i].cycle, (int)(records[i].tag_stage >> EVENT_TAG_BITS),
+                        records[i].tag_stage & tag_mask);
+        }
+    }
+
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "procsim_pool.hpp"
+#include <thread>
+
+using namespace procsim;
+
+// the worker the current thread is, while it runs a job
+static thread_local unsigned current_worker = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned threads)
+    : threads(threads == 0 ? 1 : threads), queues(threads == 0 ? 1 : threads), outstanding(0), queued(0), ran(0)
+{
+}
+
+void WorkStealingPool::run(size_t jobs, const std::function<void(size_t)>& fn)
+{
+    for (size_t i = 0; i < jobs; i++) {
+        queues[i % threads].jobs.push_back(i);
+    }
+    outstanding = jobs;
+    queued = jobs;
+    ran = 0;
+
+    // the calling thread works as worker 0
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++) {
+        workers.push_back(std::thread(&WorkStealingPool::worker, this, i, &fn));
+    }
+    worker(0, &fn);
+    for (auto& t : workers) {
+        t.join();
+    }
+}
+
+void WorkStealingPool::push(size_t job)
+{
+    outstanding++;
+    {
+        WorkQueue& own = queues[current_worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        own.jobs.push_front(job);
+        queued++;
+    }
+    std::lock_guard<std::mutex> guard(idle_lock);
+    idle.notify_one();
+}
+
+bool WorkStealingPool::take(unsigned self, size_t* job)
+{
+    {
+        WorkQueue& own = queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.jobs.empty()) {
+            *job = own.jobs.front();
+            own.jobs.pop_front();
+            queued--;
+            return true;
+        }
+    }
+
+    // steal the job furthest from the victim's head
+    for (unsigned i = 1; i < threads; i++) {
+        WorkQueue& victim = queues[(self + i) % threads];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty()) {
+            *job = victim.jobs.back();
+            victim.jobs.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::worker(unsigned self, const std::function<void(size_t)>* fn)
+{
+    current_worker = self;
+    size_t job;
+    for (;;) {
+        if (take(self, &job)) {
+            (*fn)(job);
+            ran++;
+            if (--outstanding == 0) {
+                std::lock_guard<std::mutex> guard(idle_lock);
+                idle.notify_all();
+            }
+            continue;
+        }
+
+        // nothing to take: done once nothing is running either, since only
+        // a running job can push more
+        std::unique_lock<std::mutex> lock(idle_lock);
+        idle.wait(lock, [this] { return outstanding == 0 || queued > 0; });
+        if (outstanding == 0) return;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef PROCSIM_POOL_HPP
+#define PROCSIM_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace procsim {
+
+// Runs independent jobs 0..n-1 on a fixed set of worker threads. Each worker
+// owns a deque of job indices (seeded round-robin) and takes work from its
+// front; once empty it steals from the back of another worker's deque, so
+// uneven job run times still keep every thread busy. A running job may
+// push() further job indices of its own choosing, which run() also waits
+// for; a worker with nothing to take sleeps until one is pushed.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threads);
+
+    // blocks until fn has been called once for every job index, and once for
+    // every index pushed while it ran
+    void run(size_t jobs, const std::function<void(size_t)>& fn);
+    // only from inside fn: queues job on the calling worker
+    void push(size_t job);
+
+    unsigned size() const { return threads; }
+    // jobs fn was called for by the last run(), pushed ones included
+    size_t jobs_run() const { return ran; }
+
+private:
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    bool take(unsigned self, size_t* job);
+    void worker(unsigned self, const std::function<void(size_t)>* fn);
+
+    unsigned threads;
+    std::vector<WorkQueue> queues;
+    std::atomic<size_t> outstanding;    // jobs queued or running
+    std::atomic<size_t> queued;         // jobs in some queue
+    std::atomic<size_t> ran;
+    std::mutex idle_lock;
+    std::condition_variable idle;
+};
+
+} // namespace procsim
+
+#endif
@@ -0,0 +1,486 @@
+#include "procsim_sweep.hpp"
+#include "procsim_pool.hpp"
+#include "procsim_trace.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+using namespace procsim;
+
+struct SweepRange {
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t step;
+};
+
+// parses "a", "a:b" or "a:b:step"
+static bool parse_range(const char* field, SweepRange* range)
+{
+    char* end;
+    range->lo = strtoull(field, &end, 10);
+    range->hi = range->lo;
+    range->step = 1;
+    if (end == field) return false;
+    if (*end == ':') {
+        const char* p = end + 1;
+        range->hi = strtoull(p, &end, 10);
+        if (end == p) return false;
+        if (*end == ':') {
+            p = end + 1;
+            range->step = strtoull(p, &end, 10);
+            if (end == p || range->step == 0) return false;
+        }
+    }
+    return *end == '\0' && range->lo <= range->hi;
+}
+
+// the expansion loop steps once past a range's last value, which must not wrap
+static bool range_overflows(const SweepRange& range)
+{
+    uint64_t last = range.lo + (range.hi - range.lo) / range.step * range.step;
+    return last > UINT64_MAX - range.step;
+}
+
+bool parse_sweep_file(const char* path, std::vector<sweep_config_t>& configs)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for reading\n", path);
+        return false;
+    }
+
+    char line[256];
+    int line_no = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_no++;
+        if (strchr(line, '\n') == NULL && !feof(file)) {
+            fprintf(stderr, "%s:%d: line longer than %d characters\n", path, line_no, (int)sizeof(line) - 2);
+            ok = false;
+            break;
+        }
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        SweepRange ranges[5];
+        int fields = 0;
+        for (char* tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+            if (fields == 5 || !parse_range(tok, &ranges[fields])) {
+                fields = -1;
+                break;
+            }
+            fields++;
+        }
+        if (fields == 0) continue;
+        if (fields != 5) {
+            fprintf(stderr, "%s:%d: expected \"R k0 k1 k2 F\"\n", path, line_no);
+            ok = false;
+            break;
+        }
+        // a range reaching 0 would otherwise expand to a machine that never
+        // finishes (F=0, k0+k1+k2=0) or never retires (R=0)
+        if (ranges[0].lo == 0 || ranges[4].lo == 0 || ranges[1].lo + ranges[2].lo + ranges[3].lo == 0) {
+            fprintf(stderr, "%s:%d: R and F (and k0+k1+k2) must be at least 1 throughout their ranges\n",
+                    path, line_no);
+            ok = false;
+            break;
+        }
+        for (int i = 0; i < 5; i++) {
+            if (range_overflows(ranges[i])) {
+                fprintf(stderr, "%s:%d: range in field %d runs past %llu\n", path, line_no, i + 1,
+                        (unsigned long long)UINT64_MAX);
+                ok = false;
+            }
+        }
+        if (!ok) break;
+
+        sweep_config_t c;
+        for (int t = 0; t < FU_TYPES; t++) {
+            c.timing.latency[t] = DEFAULT_FU_LATENCY;
+            c.timing.pipelined[t] = false;
+        }
+        c.dispatch_limit = 0;
+        c.bus_arbitration.policy = BUS_OLDEST_FIRST;
+        for (int t = 0; t < FU_TYPES; t++) {
+            c.bus_arbitration.order[t] = t;
+        }
+        c.rs_layout = RS_LAYOUT_LISTS;
+        for (c.r = ranges[0].lo; c.r <= ranges[0].hi; c.r += ranges[0].step)
+        for (c.k0 = ranges[1].lo; c.k0 <= ranges[1].hi; c.k0 += ranges[1].step)
+        for (c.k1 = ranges[2].lo; c.k1 <= ranges[2].hi; c.k1 += ranges[2].step)
+        for (c.k2 = ranges[3].lo; c.k2 <= ranges[3].hi; c.k2 += ranges[3].step)
+        for (c.f = ranges[4].lo; c.f <= ranges[4].hi; c.f += ranges[4].step)
+            configs.push_back(c);
+    }
+
+    fclose(file);
+    return ok;
+}
+
+// parses "a,b,c" into one value per FU type
+static bool parse_per_fu(const char* arg, uint64_t values[FU_TYPES])
+{
+    char* end;
+    for (int t = 0; t < FU_TYPES; t++) {
+        values[t] = strtoull(arg, &end, 10);
+        if (end == arg || *end != (t == FU_TYPES - 1 ? '\0' : ',')) return false;
+        arg = end + 1;
+    }
+    return true;
+}
+
+bool parse_machine_option(int opt, const char* arg, sweep_config_t* config)
+{
+    uint64_t per_fu[FU_TYPES];
+    switch (opt) {
+    case 'x':
+        return parse_per_fu(arg, config->timing.latency);
+    case 'p':
+        if (!parse_per_fu(arg, per_fu)) return false;
+        for (int t = 0; t < FU_TYPES; t++) {
+            config->timing.pipelined[t] = (per_fu[t] != 0);
+        }
+        return true;
+    case 'q':
+        config->dispatch_limit = strtoull(arg, NULL, 10);
+        return true;
+    case 'B':
+        if (strcmp(arg, "oldest") == 0) {
+            config->bus_arbitration.policy = BUS_OLDEST_FIRST;
+            return true;
+        }
+        if (strncmp(arg, "fu:", 3) == 0 && parse_per_fu(arg + 3, per_fu)) {
+            unsigned seen = 0;
+            for (int t = 0; t < FU_TYPES; t++) {
+                if (per_fu[t] >= FU_TYPES) return false;
+                config->bus_arbitration.order[t] = (int)per_fu[t];
+                seen |= 1u << per_fu[t];
+            }
+            if (seen != (1u << FU_TYPES) - 1) return false;
+            config->bus_arbitration.policy = BUS_FU_PRIORITY;
+            return true;
+        }
+        return false;
+    case 'A':
+        if (strcmp(arg, "lists") == 0) {
+            config->rs_layout = RS_LAYOUT_LISTS;
+        } else if (strcmp(arg, "soa") == 0) {
+            config->rs_layout = RS_LAYOUT_SOA;
+        } else {
+            return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+void apply_machine_options(const sweep_config_t& machine, std::vector<sweep_config_t>& configs)
+{
+    for (auto& config : configs) {
+        sweep_config_t shape = config;
+        config = machine;
+        config.r = shape.r;
+        config.k0 = shape.k0;
+        config.k1 = shape.k1;
+        config.k2 = shape.k2;
+        config.f = shape.f;
+    }
+}
+
+void load_trace(InstructionSource& source, std::vector<proc_inst_t>& trace)
+{
+    proc_inst_t inst;
+    while (source.read(&inst)) {
+        inst.tag = 0;
+        trace.push_back(inst);
+    }
+}
+
+void print_sweep_header(FILE* out)
+{
+    fprintf(out, "R,k0,k1,k2,F,retired_instruction,cycle_count,avg_inst_retired,avg_inst_fired,avg_disp_size,max_disp_size\n");
+}
+
+void print_sweep_row(FILE* out, const sweep_config_t& config, const proc_stats_t& stats)
+{
+    fprintf(out, "%llu,%llu,%llu,%llu,%llu,%lu,%lu,%f,%f,%f,%lu\n",
+            (unsigned long long)config.r, (unsigned long long)config.k0,
+            (unsigned long long)config.k1, (unsigned long long)config.k2,
+            (unsigned long long)config.f,
+            stats.retired_instruction, stats.cycle_count,
+            stats.avg_inst_retired, stats.avg_inst_fired, stats.avg_disp_size,
+            stats.max_disp_size);
+}
+
+void setup_config(Core& core, const sweep_config_t& config)
+{
+    core.set_fu_timing(config.timing);
+    core.set_dispatch_limit(config.dispatch_limit);
+    core.set_bus_arbitration(config.bus_arbitration);
+    core.set_rs_layout(config.rs_layout);
+    core.setup_proc(config.r, config.k0, config.k1, config.k2, config.f);
+}
+
+bool simulate_config(const std::vector<proc_inst_t>& trace, const sweep_config_t& config, proc_stats_t* p_stats)
+{
+    ArraySource source(trace.data(), trace.size());
+    Core core(&source, NULL, NULL);
+
+    memset(p_stats, 0, sizeof(proc_stats_t));
+    setup_config(core, config);
+    core.run_proc();
+    core.complete_proc(p_stats);
+    return !core.deadlocked();
+}
+
+void report_deadlock(const sweep_config_t& config)
+{
+    fprintf(stderr, "Configuration R=%llu k0=%llu k1=%llu k2=%llu F=%llu deadlocked; its row is left out\n",
+            (unsigned long long)config.r, (unsigned long long)config.k0, (unsigned long long)config.k1,
+            (unsigned long long)config.k2, (unsigned long long)config.f);
+}
+
+// everything but R, which alone can be shared across a prefix; member by
+// member, since the padding in the timing and arbitration structs is unset
+static bool same_but_r(const sweep_config_t& a, const sweep_config_t& b)
+{
+    if (a.k0 != b.k0 || a.k1 != b.k1 || a.k2 != b.k2 || a.f != b.f || a.dispatch_limit != b.dispatch_limit ||
+        a.bus_arbitration.policy != b.bus_arbitration.policy || a.rs_layout != b.rs_layout) {
+        return false;
+    }
+    for (int t = 0; t < FU_TYPES; t++) {
+        if (a.timing.latency[t] != b.timing.latency[t] || a.timing.pipelined[t] != b.timing.pipelined[t] ||
+            a.bus_arbitration.order[t] != b.bus_arbitration.order[t]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// runs core from its current state to the end of the trace; false if it
+// deadlocked
+static bool finish_run(Core& core, proc_stats_t* p_stats)
+{
+    memset(p_stats, 0, sizeof(proc_stats_t));
+    core.run_proc();
+    core.complete_proc(p_stats);
+    return !core.deadlocked();
+}
+
+void finish_forked(forked_run_t& run, std::vector<proc_stats_t>& results, std::vector<char>& deadlocked)
+{
+    deadlocked[run.config] = !finish_run(*run.core, &results[run.config]);
+}
+
+void simulate_group(const std::vector<proc_inst_t>& trace, const std::vector<sweep_config_t>& configs,
+                    const std::vector<size_t>& members, std::vector<proc_stats_t>& results,
+                    std::vector<char>& deadlocked, const std::function<void(forked_run_t*)>& hand_off)
+{
+    // the cycles the leader runs between snapshots; a member that diverges
+    // re-simulates at most this many cycles of shared prefix
+    const uint64_t CHUNK = 16384;
+
+    // the leader has the most buses; members diverge from it smallest R first
+    std::vector<size_t> order(members);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return configs[a].r < configs[b].r; });
+    const sweep_config_t& top = configs[order.back()];
+    uint64_t top_r = top.r;
+
+    ArraySource lead_source(trace.data(), trace.size());
+    Core lead(&lead_source, NULL, NULL);
+    setup_config(lead, top);
+
+    // the leader's state at the start of the current chunk, if past cycle 0
+    Core snapshot(NULL, NULL, NULL);
+    bool have_snapshot = false;
+
+    size_t next = 0;
+    while (next < order.size() && configs[order[next]].r < top_r) {
+        proc_counters_t at;
+        lead.read_counters(&at);
+        if (at.cycles > 0) {
+            snapshot.fork(lead, top_r);
+            have_snapshot = true;
+        }
+        bool more = lead.run_until(at.cycles + CHUNK);
+
+        // members whose R the leader has now outrun diverged in this chunk
+        while (next < order.size() && configs[order[next]].r < lead.peak_bus_demand()) {
+            const sweep_config_t& config = configs[order[next]];
+            std::unique_ptr<forked_run_t> run(new forked_run_t);
+            run->config = order[next];
+            run->source.reset(new ArraySource(trace.data(), trace.size()));
+            run->core.reset(new Core(run->source.get(), NULL, NULL));
+            if (have_snapshot) {
+                run->core->fork(snapshot, config.r);
+                run->source->skip(run->core->trace_offset());
+            } else {
+                setup_config(*run->core, config);
+            }
+            if (hand_off) {
+                hand_off(run.release());
+            } else {
+                finish_forked(*run, results, deadlocked);
+            }
+            next++;
+        }
+        if (!more) break;
+    }
+
+    // whoever is left never had its R exceeded, so ran exactly as the leader
+    proc_stats_t stats;
+    bool stuck = !finish_run(lead, &stats);
+    for (; next < order.size(); next++) {
+        results[order[next]] = stats;
+        deadlocked[order[next]] = stuck;
+    }
+}
+
+bool run_sweep(const std::vector<proc_inst_t>& trace, const std::vector<sweep_config_t>& configs,
+               unsigned threads, FILE* out, size_t* jobs_run)
+{
+    std::vector<proc_stats_t> results(configs.size());
+    std::vector<char> deadlocked(configs.size(), false);
+    bool ok = true;
+    std::vector<bool> finished(configs.size(), false);
+    std::mutex print_lock;
+    size_t next_row = 0;
+
+    // configurations that differ only in R share one job
+    std::vector<std::vector<size_t> > groups;
+    for (size_t i = 0; i < configs.size(); i++) {
+        size_t g = 0;
+        while (g < groups.size() && !same_but_r(configs[groups[g][0]], configs[i])) g++;
+        if (g == groups.size()) groups.push_back(std::vector<size_t>());
+        groups[g].push_back(i);
+    }
+
+    print_sweep_header(out);
+
+    // jobs past the groups finish forked member job - groups.size()
+    std::vector<std::unique_ptr<forked_run_t> > forked(configs.size());
+    WorkStealingPool pool(threads);
+    pool.run(groups.size(), [&](size_t job) {
+        std::vector<size_t> done;
+        if (job >= groups.size()) {
+            forked_run_t& run = *forked[job - groups.size()];
+            finish_forked(run, results, deadlocked);
+            done.push_back(run.config);
+            forked[job - groups.size()].reset();
+        } else if (groups[job].size() == 1) {
+            size_t i = groups[job][0];
+            deadlocked[i] = !simulate_config(trace, configs[i], &results[i]);
+            done = groups[job];
+        } else {
+            std::vector<bool> handed_off(configs.size(), false);
+            simulate_group(trace, configs, groups[job], results, deadlocked, [&](forked_run_t* run) {
+                handed_off[run->config] = true;
+                forked[run->config].reset(run);
+                pool.push(groups.size() + run->config);
+            });
+            for (size_t i : groups[job]) {
+                if (!handed_off[i]) done.push_back(i);
+            }
+        }
+
+        // emit every row whose predecessors are all done
+        std::lock_guard<std::mutex> guard(print_lock);
+        for (size_t i : done) finished[i] = true;
+        while (next_row < configs.size() && finished[next_row]) {
+            if (deadlocked[next_row]) {
+                report_deadlock(configs[next_row]);
+                ok = false;
+            } else {
+                print_sweep_row(out, configs[next_row], results[next_row]);
+            }
+            next_row++;
+        }
+    });
+    if (jobs_run) *jobs_run = pool.jobs_run();
+    return ok;
+}
+
+std::shared_ptr<const decoded_trace_t> TraceCache::acquire(const std::string& path)
+{
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::shared_ptr<Entry>& slot = entries[path];
+        if (!slot) slot = std::make_shared<Entry>();
+        entry = slot;
+    }
+
+    std::lock_guard<std::mutex> guard(entry->lock);
+    std::shared_ptr<const decoded_trace_t> trace = entry->trace.lock();
+    if (trace) {
+        return trace;
+    }
+
+    FILE* file = fopen(path.c_str(), "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for reading\n", path.c_str());
+        return trace;
+    }
+    InstructionSource* source = open_trace(fileno(file));
+    if (source != NULL) {
+        std::shared_ptr<decoded_trace_t> decoded = std::make_shared<decoded_trace_t>();
+        load_trace(*source, *decoded);
+        delete source;
+        trace = decoded;
+        entry->trace = trace;
+    }
+    fclose(file);
+    return trace;
+}
+
+bool run_trace_sweep(TraceCache& cache, const std::vector<std::string>& paths,
+                     const std::vector<sweep_config_t>& configs, unsigned threads, FILE* out)
+{
+    WorkStealingPool pool(threads);
+
+    // decode the traces in parallel first
+    std::vector<std::shared_ptr<const decoded_trace_t> > traces(paths.size());
+    pool.run(paths.size(), [&](size_t job) {
+        traces[job] = cache.acquire(paths[job]);
+    });
+    for (auto& trace : traces) {
+        if (!trace) return false;
+    }
+
+    size_t jobs = paths.size() * configs.size();
+    std::vector<proc_stats_t> results(jobs);
+    std::vector<bool> finished(jobs, false);
+    std::vector<size_t> remaining(paths.size(), configs.size());
+    std::mutex print_lock;
+    size_t next_row = 0;
+
+    fprintf(out, "trace,");
+    print_sweep_header(out);
+
+    std::vector<char> deadlocked(jobs, false);
+    bool ok = true;
+    pool.run(jobs, [&](size_t job) {
+        size_t t = job / configs.size();
+        deadlocked[job] = !simulate_config(*traces[t], configs[job % configs.size()], &results[job]);
+
+        std::lock_guard<std::mutex> guard(print_lock);
+        if (--remaining[t] == 0) {
+            traces[t].reset();
+        }
+        finished[job] = true;
+        while (next_row < jobs && finished[next_row]) {
+            if (deadlocked[next_row]) {
+                fprintf(stderr, "%s: ", paths[next_row / configs.size()].c_str());
+                report_deadlock(configs[next_row % configs.size()]);
+                ok = false;
+            } else {
+                fprintf(out, "%s,", paths[next_row / configs.size()].c_str());
+                print_sweep_row(out, configs[next_row % configs.size()], results[next_row]);
+            }
+            next_row++;
+        }
+    });
+    return ok;
+}
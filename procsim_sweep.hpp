@@ -0,0 +1,125 @@
+#ifndef PROCSIM_SWEEP_HPP
+#define PROCSIM_SWEEP_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "procsim.hpp"
+
+typedef struct _sweep_config_t
+{
+    uint64_t r;
+    uint64_t k0;
+    uint64_t k1;
+    uint64_t k2;
+    uint64_t f;
+    fu_timing_t timing;
+    uint64_t dispatch_limit;        // dispatch queue capacity, 0 for unbounded
+    bus_arbitration_t bus_arbitration;
+    rs_layout_t rs_layout;
+} sweep_config_t;
+
+// Reads one "R k0 k1 k2 F" configuration per line ('#' starts a comment).
+// Any field may also be a range lo:hi or lo:hi:step, which expands to every
+// combination with the other fields of that line. R, F and k0+k1+k2 must be
+// at least 1 everywhere in the ranges. FU timing is left at the
+// single-cycle default, the dispatch queue unbounded, the result buses
+// oldest-first and the RS in lists.
+bool parse_sweep_file(const char* path, std::vector<sweep_config_t>& configs);
+
+// Applies one of procsim's machine options to config: opt is 'x', 'p', 'q',
+// 'B' or 'A' and arg its argument, as procsim -h describes them. False if
+// arg does not parse.
+bool parse_machine_option(int opt, const char* arg, sweep_config_t* config);
+
+// Gives every configuration the machine options of machine, keeping only
+// its own R, k0, k1, k2 and F
+void apply_machine_options(const sweep_config_t& machine, std::vector<sweep_config_t>& configs);
+
+// Reads the whole of source into trace
+void load_trace(procsim::InstructionSource& source, std::vector<proc_inst_t>& trace);
+
+// Simulates every configuration over the shared trace on `threads` workers,
+// with configurations that differ only in R grouped onto one simulate_group
+// job, each member it forks then finishing as a job of its own. Rows are
+// written in configuration order regardless of the thread count; a
+// configuration that deadlocks gets no row, is named on stderr and makes
+// the sweep return false. jobs_run, if given, receives the number of jobs.
+bool run_sweep(const std::vector<proc_inst_t>& trace, const std::vector<sweep_config_t>& configs,
+               unsigned threads, FILE* out, size_t* jobs_run = NULL);
+
+// A member of an R group that has left its leader: core holds its state,
+// reading from source, and only has to be run to the end of the trace
+struct forked_run_t {
+    size_t config;
+    std::unique_ptr<procsim::ArraySource> source;
+    std::unique_ptr<procsim::Core> core;
+};
+
+// runs a forked member to the end into results[run.config], flagging
+// deadlocked[run.config] if it stuck
+void finish_forked(forked_run_t& run, std::vector<proc_stats_t>& results, std::vector<char>& deadlocked);
+
+// Simulates configs[members], which must differ only in R, as one run with
+// the largest R. Each smaller-R member forks from it only once more
+// instructions compete for the buses in a cycle than that member has, and
+// a member never forked gets the leader's stats. A forked member goes to
+// hand_off if given, which takes it over, and is otherwise finished here.
+// deadlocked[i] is set for each member i whose run stuck.
+void simulate_group(const std::vector<proc_inst_t>& trace, const std::vector<sweep_config_t>& configs,
+                    const std::vector<size_t>& members, std::vector<proc_stats_t>& results,
+                    std::vector<char>& deadlocked, const std::function<void(forked_run_t*)>& hand_off = nullptr);
+
+// Gives core every machine option of config, then calls setup_proc
+void setup_config(procsim::Core& core, const sweep_config_t& config);
+
+// Simulates one configuration with logging and per-instruction output off;
+// false if it deadlocked
+bool simulate_config(const std::vector<proc_inst_t>& trace, const sweep_config_t& config, proc_stats_t* p_stats);
+
+// names config on stderr as one that deadlocked
+void report_deadlock(const sweep_config_t& config);
+
+void print_sweep_header(FILE* out);
+void print_sweep_row(FILE* out, const sweep_config_t& config, const proc_stats_t& stats);
+
+typedef std::vector<proc_inst_t> decoded_trace_t;
+
+namespace procsim {
+
+// Decoded traces by path, each parsed once however many runs share it. The
+// cache only holds weak references: a trace stays in memory while some
+// caller still holds the pointer acquire() returned, and is decoded again
+// if asked for after the last one let go.
+class TraceCache {
+public:
+    // NULL if the file cannot be opened or decoded; safe to call from
+    // several threads, including for the same path
+    std::shared_ptr<const decoded_trace_t> acquire(const std::string& path);
+
+private:
+    struct Entry {
+        std::mutex lock;    // held while decoding
+        std::weak_ptr<const decoded_trace_t> trace;
+    };
+
+    std::mutex lock;
+    std::map<std::string, std::shared_ptr<Entry> > entries;
+};
+
+} // namespace procsim
+
+// Simulates every configuration against every trace on `threads` workers,
+// decoding each trace once through cache, and writes one CSV with a leading
+// trace column. Rows are in (trace, configuration) order; a trace is
+// released as soon as its last configuration has run. Returns false if a
+// trace cannot be read or a run deadlocked (which gets no row).
+bool run_trace_sweep(procsim::TraceCache& cache, const std::vector<std::string>& paths,
+                     const std::vector<sweep_config_t>& configs, unsigned threads, FILE* out);
+
+#endif
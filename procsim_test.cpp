@@ -0,0 +1,338 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "procsim.hpp"
+#include "procsim_digest.hpp"
+#include "procsim_sweep.hpp"
+#include "procsim_trace.hpp"
+
+using namespace procsim;
+
+//
+// procsim-test
+//
+//  checks of the sweep machinery, checkpoints and run digests against plain
+//  single-configuration runs, over a bundled trace; prints each check and
+//  exits non-zero on a failure
+//
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok) failures++;
+}
+
+static bool load(const char* path, std::vector<proc_inst_t>& trace)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for reading\n", path);
+        return false;
+    }
+    InstructionSource* source = open_trace(fileno(file));
+    if (source == NULL) {
+        fclose(file);
+        return false;
+    }
+    load_trace(*source, trace);
+    delete source;
+    fclose(file);
+    return true;
+}
+
+// everything written to a tmpfile(), which it closes
+static std::string slurp(FILE* out)
+{
+    std::string text;
+    rewind(out);
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), out)) > 0) text.append(buf, n);
+    fclose(out);
+    return text;
+}
+
+// TextTraceSource must read what the original fscanf loop read, record for
+// record, including a bare "0x" address (which fscanf takes as 0)
+static void test_text_parser(void)
+{
+    const char* text = "0x 1 2 3 4\n0x1f 0 -1 5 -1\n  ab -1 7 -1 3\n0X10 2 1 2 3\n+0x20\t0 0 0 0\n";
+    FILE* expected_in = tmpfile();
+    FILE* parsed_in = tmpfile();
+    fputs(text, expected_in);
+    fputs(text, parsed_in);
+    rewind(expected_in);
+    rewind(parsed_in);
+
+    std::vector<proc_inst_t> expected;
+    proc_inst_t inst;
+    while (fscanf(expected_in, "%x %d %d %d %d", &inst.instruction_address, &inst.op_code, &inst.dest_reg,
+                  &inst.src_reg[0], &inst.src_reg[1]) == 5) {
+        expected.push_back(inst);
+    }
+    fclose(expected_in);
+
+    std::vector<proc_inst_t> parsed;
+    TextTraceSource source(fileno(parsed_in));
+    while (source.read(&inst)) parsed.push_back(inst);
+    fclose(parsed_in);
+
+    bool same = expected.size() == 5 && parsed.size() == expected.size();
+    for (size_t i = 0; same && i < parsed.size(); i++) {
+        same = parsed[i].instruction_address == expected[i].instruction_address &&
+               parsed[i].op_code == expected[i].op_code && parsed[i].dest_reg == expected[i].dest_reg &&
+               parsed[i].src_reg[0] == expected[i].src_reg[0] && parsed[i].src_reg[1] == expected[i].src_reg[1];
+    }
+    check(same, "text trace parser reads the same records as fscanf");
+}
+
+// a record with an op code or register no stage can index ends the trace
+// there, as a parse failure does, instead of reaching the core
+static void test_invalid_records(void)
+{
+    const char* text = "0x10 1 2 3 4\n0x14 3 2 3 4\n0x18 1 2 3 4\n";
+    FILE* in = tmpfile();
+    fputs(text, in);
+    rewind(in);
+    TextTraceSource source(fileno(in));
+    proc_inst_t buf[3];
+    size_t got = source.read(buf, 3);
+    fclose(in);
+    check(got == 1, "text trace parser ends the trace at an op code outside -1..2");
+
+    // the same records, with a register past the table, as a binary trace
+    FILE* binary = tmpfile();
+    trace_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(trace_record_t);
+    header.count = 3;
+    fwrite(&header, sizeof(header), 1, binary);
+    for (int i = 0; i < 3; i++) {
+        trace_record_t rec = { (uint32_t)(0x10 + 4 * i), 1, (int8_t)(i == 1 ? -5 : 2), { 3, 4 } };
+        fwrite(&rec, sizeof(rec), 1, binary);
+    }
+    fflush(binary);
+    MappedTraceSource* mapped = MappedTraceSource::open(fileno(binary));
+    got = mapped ? mapped->read(buf, 3) : 0;
+    delete mapped;
+    fclose(binary);
+    check(got == 1, "binary trace reader ends the trace at a register outside the table");
+}
+
+// a config with every machine option at its default
+static sweep_config_t make_config(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f)
+{
+    sweep_config_t config = { r, k0, k1, k2, f, {}, 0, { BUS_OLDEST_FIRST, { 0, 1, 2 } }, RS_LAYOUT_LISTS };
+    for (int t = 0; t < FU_TYPES; t++) config.timing.latency[t] = DEFAULT_FU_LATENCY;
+    return config;
+}
+
+// runs the sweep into csv; returns the number of pool jobs
+static size_t sweep_csv(const std::vector<proc_inst_t>& trace, const std::vector<sweep_config_t>& configs,
+                        unsigned threads, std::string& csv)
+{
+    FILE* out = tmpfile();
+    size_t jobs = 0;
+    run_sweep(trace, configs, threads, out, &jobs);
+    csv = slurp(out);
+    return jobs;
+}
+
+// an R-only grid, "1:16 4 4 4 8", shares one leader but must still spread
+// over the pool, and give the rows independent runs would
+static void test_r_only_sweep(const std::vector<proc_inst_t>& trace)
+{
+    std::vector<sweep_config_t> configs;
+    for (uint64_t r = 1; r <= 16; r++) {
+        configs.push_back(make_config(r, 4, 4, 4, 8));
+    }
+
+    std::string serial, parallel;
+    sweep_csv(trace, configs, 1, serial);
+    size_t jobs = sweep_csv(trace, configs, 4, parallel);
+    check(jobs > 1, "R-only sweep runs as more than one job");
+    check(serial == parallel, "R-only sweep rows do not depend on the thread count");
+
+    FILE* out = tmpfile();
+    print_sweep_header(out);
+    for (auto& config : configs) {
+        proc_stats_t stats;
+        simulate_config(trace, config, &stats);
+        print_sweep_row(out, config, stats);
+    }
+    check(parallel == slurp(out), "R-only sweep rows match independent runs");
+}
+
+// the INST/FETCH/DISP/SCHED/EXEC/STATE rows of an output file
+static std::string timing_rows(const std::string& text)
+{
+    std::string rows;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) end = text.size();
+        std::string line = text.substr(pos, end - pos);
+        if (!line.empty() && line[0] >= '0' && line[0] <= '9' && line.find('\t') != std::string::npos) {
+            rows += line + "\n";
+        }
+        pos = end + 1;
+    }
+    return rows;
+}
+
+// finishes a run on core; its stats and counters as JSON
+static std::string finish_json(Core& core)
+{
+    proc_stats_t stats;
+    core.run_proc();
+    core.complete_proc(&stats);
+    FILE* json = tmpfile();
+    core.print_json(json, stats);
+    return slurp(json);
+}
+
+// a run saved at cycle `cycle` and restored from the checkpoint must write
+// the same timing rows, stats and counters as a run left alone
+static void test_checkpoint(const std::vector<proc_inst_t>& trace, sweep_config_t config, uint64_t cycle,
+                            const char* what)
+{
+    FILE* whole = tmpfile();
+    std::string whole_json;
+    {
+        ArraySource source(trace.data(), trace.size());
+        Core core(&source, NULL, whole);
+        setup_config(core, config);
+        whole_json = finish_json(core);
+    }
+
+    FILE* before = tmpfile();
+    FILE* after = tmpfile();
+    FILE* checkpoint = tmpfile();
+    bool saved, restored;
+    std::string restored_json;
+    {
+        ArraySource source(trace.data(), trace.size());
+        Core core(&source, NULL, before);
+        setup_config(core, config);
+        saved = core.run_until(cycle) && core.save_checkpoint(checkpoint);
+    }
+    rewind(checkpoint);
+    {
+        ArraySource source(trace.data(), trace.size());
+        Core core(&source, NULL, after);
+        restored = core.restore_checkpoint(checkpoint);
+        if (restored) restored_json = finish_json(core);
+    }
+    fclose(checkpoint);
+
+    std::string message = std::string("checkpoint and restore mid-run, ") + what;
+    check(saved && restored, (message + ": saves and restores").c_str());
+    check(restored_json == whole_json, (message + ": same stats and counters as a whole run").c_str());
+    // the checkpoint falls mid-run, so both halves have rows
+    std::string rows_before = timing_rows(slurp(before));
+    std::string rows_after = timing_rows(slurp(after));
+    check(!rows_before.empty() && !rows_after.empty() && rows_before + rows_after == timing_rows(slurp(whole)),
+          (message + ": same timing rows as a whole run").c_str());
+}
+
+// one run of config over trace, folded into digest
+static void digest_run(const std::vector<proc_inst_t>& trace, const sweep_config_t& config, RunDigest* digest)
+{
+    ArraySource source(trace.data(), trace.size());
+    Core core(&source, NULL, NULL);
+    core.set_digest(digest);
+    setup_config(core, config);
+    finish_json(core);
+}
+
+// the first cycle, or the window of cycles, where digest reports divergence
+static bool divergence(const RunDigest& digest, unsigned long long* lo, unsigned long long* hi)
+{
+    FILE* out = tmpfile();
+    digest.report(out);
+    std::string text = slurp(out);
+    if (sscanf(text.c_str(), "Digest diverges from golden at cycle %llu", lo) == 1) {
+        *hi = *lo;
+        return true;
+    }
+    return sscanf(text.c_str(), "Digest diverges from golden within cycles %llu-%llu", lo, hi) == 2;
+}
+
+// identical runs, and runs on either RS layout, digest the same; a trace
+// with one instruction changed diverges, within the window the marks bracket
+static void test_digest(const std::vector<proc_inst_t>& trace)
+{
+    sweep_config_t config = make_config(2, 1, 2, 2, 4);
+    RunDigest first(DIGEST_INTERVAL), second(DIGEST_INTERVAL), soa(DIGEST_INTERVAL);
+    digest_run(trace, config, &first);
+    digest_run(trace, config, &second);
+    config.rs_layout = RS_LAYOUT_SOA;
+    digest_run(trace, config, &soa);
+    config.rs_layout = RS_LAYOUT_LISTS;
+    check(first.hash() == second.hash(), "digest: identical runs match");
+    check(first.hash() == soa.hash(), "digest: -A lists and -A soa runs match");
+
+    // the middle instruction now waits on a producer it did not have
+    std::vector<proc_inst_t> perturbed(trace);
+    size_t middle = perturbed.size() / 2;
+    perturbed[middle].src_reg[0] = perturbed[middle - 1].dest_reg >= 0 ? perturbed[middle - 1].dest_reg : 1;
+    perturbed[middle].op_code = 2;
+
+    char path[] = "/tmp/procsim-test-digest-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        check(false, "digest: creates a golden file");
+        return;
+    }
+    close(fd);
+
+    // the exact diverging cycle from a golden marked every cycle, then the
+    // window a coarser golden narrows it to
+    unsigned long long cycle = 0, unused, lo = 0, hi = 0;
+    RunDigest exact_golden(1);
+    digest_run(trace, config, &exact_golden);
+    RunDigest exact(1);
+    bool found_exact = exact_golden.save(path) && exact.load_golden(path);
+    if (found_exact) digest_run(perturbed, config, &exact);
+    found_exact = found_exact && !exact.matches() && divergence(exact, &cycle, &unused);
+
+    RunDigest window(DIGEST_INTERVAL);
+    bool found_window = first.save(path) && window.load_golden(path);
+    if (found_window) digest_run(perturbed, config, &window);
+    found_window = found_window && !window.matches() && divergence(window, &lo, &hi);
+    unlink(path);
+
+    check(found_exact && cycle > 0, "digest: a perturbed run diverges, at an exact cycle with -Z 1");
+    check(found_window && lo <= cycle && cycle <= hi && hi - lo < DIGEST_INTERVAL,
+          "digest: a perturbed run's window holds the exact diverging cycle");
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = argc > 1 ? argv[1] : "traces/gcc.100k.trace";
+    std::vector<proc_inst_t> trace;
+    if (!load(path, trace)) {
+        return 1;
+    }
+
+    test_text_parser();
+    test_invalid_records();
+    test_r_only_sweep(trace);
+
+    test_checkpoint(trace, make_config(8, 1, 2, 3, 4), 20000, "default machine");
+    sweep_config_t pipelined = make_config(2, 2, 2, 2, 8);
+    pipelined.timing.latency[2] = 4;
+    pipelined.timing.pipelined[2] = true;
+    pipelined.rs_layout = RS_LAYOUT_SOA;
+    test_checkpoint(trace, pipelined, 12345, "soa layout and a pipelined FU");
+    test_digest(trace);
+
+    printf("%d failure%s\n", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,439 @@
+#include "procsim_trace.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <zlib.h>
+#ifdef PROCSIM_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace procsim;
+
+ssize_t FdStream::read(char* buf, size_t n)
+{
+    ssize_t got;
+    do {
+        got = ::read(fd, buf, n);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0) perror("read");
+    return got;
+}
+
+GzipStream::GzipStream(int fd)
+{
+    // gzclose closes its descriptor, and the caller still owns fd
+    int own = dup(fd);
+    gzFile gz = (own >= 0) ? gzdopen(own, "rb") : NULL;
+    if (gz != NULL) {
+        gzbuffer(gz, 1 << 20);
+    } else if (own >= 0) {
+        close(own);
+    }
+    file = gz;
+}
+
+GzipStream::~GzipStream()
+{
+    if (file != NULL) gzclose((gzFile)file);
+}
+
+ssize_t GzipStream::read(char* buf, size_t n)
+{
+    if (file == NULL) return -1;
+    int got = gzread((gzFile)file, buf, (unsigned)std::min(n, (size_t)INT_MAX));
+    if (got < 0) {
+        int err;
+        fprintf(stderr, "gzip: %s\n", gzerror((gzFile)file, &err));
+    }
+    return got;
+}
+
+#ifdef PROCSIM_HAVE_ZSTD
+ZstdStream::ZstdStream(int fd)
+    : fd(fd), dstream(ZSTD_createDStream()), in(ZSTD_DStreamInSize()), in_pos(0), in_len(0), in_eof(false)
+{
+    ZSTD_initDStream((ZSTD_DStream*)dstream);
+}
+
+ZstdStream::~ZstdStream()
+{
+    ZSTD_freeDStream((ZSTD_DStream*)dstream);
+}
+
+ssize_t ZstdStream::read(char* buf, size_t n)
+{
+    ZSTD_outBuffer out = { buf, n, 0 };
+    while (out.pos == 0) {
+        if (in_pos == in_len && !in_eof) {
+            ssize_t got = FdStream(fd).read(in.data(), in.size());
+            if (got < 0) return -1;
+            in_eof = (got == 0);
+            in_pos = 0;
+            in_len = (size_t)got;
+        }
+
+        // keep calling once the input is gone to drain buffered output
+        ZSTD_inBuffer input = { in.data(), in_len, in_pos };
+        size_t ret = ZSTD_decompressStream((ZSTD_DStream*)dstream, &out, &input);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+            return -1;
+        }
+        in_pos = input.pos;
+        if (in_eof && in_pos == in_len && out.pos == 0) break;
+    }
+    return (ssize_t)out.pos;
+}
+#endif
+
+bool encode_record(const proc_inst_t* p_inst, trace_record_t* p_rec)
+{
+    p_rec->instruction_address = p_inst->instruction_address;
+    p_rec->op_code = (int8_t)p_inst->op_code;
+    p_rec->dest_reg = (int8_t)p_inst->dest_reg;
+    p_rec->src_reg[0] = (int8_t)p_inst->src_reg[0];
+    p_rec->src_reg[1] = (int8_t)p_inst->src_reg[1];
+    return p_rec->op_code == p_inst->op_code && p_rec->dest_reg == p_inst->dest_reg &&
+           p_rec->src_reg[0] == p_inst->src_reg[0] && p_rec->src_reg[1] == p_inst->src_reg[1];
+}
+
+MappedTraceSource::MappedTraceSource(void* map, size_t map_len, const trace_record_t* records, uint64_t count)
+    : map(map), map_len(map_len), records(records), count(count), pos(0)
+{
+}
+
+MappedTraceSource* MappedTraceSource::open(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(trace_header_t)) {
+        return NULL;
+    }
+
+    // pread keeps the file offset where a text reader expects it
+    trace_header_t header;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0) {
+        return NULL;
+    }
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t) ||
+        header.count > ((uint64_t)st.st_size - sizeof(trace_header_t)) / sizeof(trace_record_t)) {
+        fprintf(stderr, "Unsupported or truncated binary trace\n");
+        return NULL;
+    }
+
+    size_t map_len = (size_t)st.st_size;
+    void* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    madvise(map, map_len, MADV_SEQUENTIAL);
+
+    const trace_record_t* records = (const trace_record_t*)((const char*)map + sizeof(trace_header_t));
+    return new MappedTraceSource(map, map_len, records, header.count);
+}
+
+MappedTraceSource::~MappedTraceSource()
+{
+    munmap(map, map_len);
+}
+
+// a record no stage could index ends the trace, as a parse failure does
+static void report_malformed(uint64_t records)
+{
+    fprintf(stderr, "Malformed trace record after %llu instructions; the trace ends there\n",
+            (unsigned long long)records);
+}
+
+bool MappedTraceSource::read(proc_inst_t* p_inst)
+{
+    return read(p_inst, 1) == 1;
+}
+
+size_t MappedTraceSource::read(proc_inst_t* buf, size_t n)
+{
+    if (n > count - pos) n = count - pos;
+    const trace_record_t* rec = &records[pos];
+    for (size_t i = 0; i < n; i++) {
+        decode_record(&rec[i], &buf[i]);
+        if (!valid_instruction(buf[i])) {
+            report_malformed(pos + i);
+            pos = count;
+            return i;
+        }
+    }
+    pos += n;
+    return n;
+}
+
+TextTraceSource::TextTraceSource(int fd)
+    : stream(new FdStream(fd)), block(new char[BLOCK_SIZE]), pos(block), end(block), eof(false), failed(false), records(0)
+{
+}
+
+TextTraceSource::TextTraceSource(ByteStream* stream)
+    : stream(stream), block(new char[BLOCK_SIZE]), pos(block), end(block), eof(false), failed(false), records(0)
+{
+}
+
+TextTraceSource::~TextTraceSource()
+{
+    delete stream;
+    delete[] block;
+}
+
+bool TextTraceSource::fill()
+{
+    if (eof) return false;
+    ssize_t got = stream->read(block, BLOCK_SIZE);
+    if (got <= 0) {
+        eof = true;
+        return false;
+    }
+    pos = block;
+    end = block + got;
+    return true;
+}
+
+void TextTraceSource::skip_space()
+{
+    int c;
+    while ((c = peek()) == ' ' || (c >= '\t' && c <= '\r')) {
+        pos++;
+    }
+}
+
+static inline int hex_digit(int c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// %x: optional sign, optional 0x prefix, hex digits
+bool TextTraceSource::parse_hex(uint32_t* value)
+{
+    skip_space();
+    bool negative = false;
+    int c = peek();
+    if (c == '-' || c == '+') {
+        negative = (c == '-');
+        pos++;
+    }
+
+    uint32_t v = 0;
+    int digits = 0;
+    int d;
+    while ((d = hex_digit(peek())) >= 0) {
+        pos++;
+        digits++;
+        v = v * 16 + d;
+        if (digits == 1 && v == 0 && (peek() == 'x' || peek() == 'X')) {
+            // a bare "0x" is 0, as fscanf reads it
+            pos++;
+        }
+    }
+    if (digits == 0) return false;
+
+    *value = negative ? (uint32_t)(0u - v) : v;
+    return true;
+}
+
+// %d: optional sign, decimal digits
+bool TextTraceSource::parse_dec(int32_t* value)
+{
+    skip_space();
+    bool negative = false;
+    int c = peek();
+    if (c == '-' || c == '+') {
+        negative = (c == '-');
+        pos++;
+    }
+
+    uint32_t v = 0;
+    int digits = 0;
+    while ((c = peek()) >= '0' && c <= '9') {
+        pos++;
+        digits++;
+        v = v * 10 + (c - '0');
+    }
+    if (digits == 0) return false;
+
+    *value = negative ? -(int32_t)v : (int32_t)v;
+    return true;
+}
+
+bool TextTraceSource::read(proc_inst_t* p_inst)
+{
+    // like fscanf, a malformed record ends the trace
+    if (failed) return false;
+    failed = !(parse_hex(&p_inst->instruction_address) &&
+               parse_dec(&p_inst->op_code) &&
+               parse_dec(&p_inst->dest_reg) &&
+               parse_dec(&p_inst->src_reg[0]) &&
+               parse_dec(&p_inst->src_reg[1]));
+    if (!failed && valid_instruction(*p_inst)) {
+        records++;
+        return true;
+    }
+    // running out of input is the normal end; anything else is reported
+    skip_space();
+    if (!failed || peek() >= 0) {
+        report_malformed(records);
+    }
+    failed = true;
+    return false;
+}
+
+size_t TextTraceSource::read(proc_inst_t* buf, size_t n)
+{
+    size_t got = 0;
+    while (got < n && read(&buf[got])) got++;
+    return got;
+}
+
+PrefetchSource::PrefetchSource(InstructionSource* inner, size_t depth)
+    : inner(inner), ring(depth == 0 ? 1 : depth), head(0), head_local(0), tail(0), finished(false), stopping(false),
+      sleepers(0)
+{
+    producer = std::thread(&PrefetchSource::produce, this);
+}
+
+PrefetchSource::~PrefetchSource()
+{
+    stopping.store(true);
+    wake();
+    producer.join();
+    delete inner;
+}
+
+// returns once ready() holds, spinning first since the other side is
+// usually only a few instructions behind
+template <class Ready>
+void PrefetchSource::park(Ready ready)
+{
+    const int SPINS = 256;
+    for (int spin = 0; spin < SPINS; spin++) {
+        if (ready()) return;
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    sleepers.fetch_add(1);
+    woken.wait(guard, ready);
+    sleepers.fetch_sub(1);
+}
+
+// after publishing an index: the fence orders that store before the sleeper
+// check, pairing with the fetch_add in park()
+void PrefetchSource::wake()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load() != 0) {
+        std::lock_guard<std::mutex> guard(lock);
+        woken.notify_all();
+    }
+}
+
+void PrefetchSource::produce()
+{
+    // publish in chunks so the consumer is not held up by a deep ring
+    const size_t CHUNK = 4096;
+    const size_t size = ring.size();
+
+    uint64_t produced = tail.load(std::memory_order_relaxed);
+    for (;;) {
+        park([&] { return stopping.load() || produced - head.load(std::memory_order_acquire) < size; });
+        if (stopping.load()) return;
+        size_t start = produced % size;
+        size_t room = size - (size_t)(produced - head.load(std::memory_order_acquire));
+        size_t span = std::min(std::min(room, size - start), CHUNK);
+
+        // slots past tail belong to the producer until published
+        size_t got = inner->read(&ring[start], span);
+        produced += got;
+        tail.store(produced, std::memory_order_release);
+        if (got < span) finished.store(true, std::memory_order_release);
+        wake();
+        if (got < span) return;
+    }
+}
+
+bool PrefetchSource::read(proc_inst_t* p_inst)
+{
+    return read(p_inst, 1) == 1;
+}
+
+size_t PrefetchSource::read(proc_inst_t* buf, size_t n)
+{
+    const size_t size = ring.size();
+    // head is published (and the producer woken) only every quarter ring,
+    // and before parking, so a fetch group costs no fence
+    const uint64_t batch = std::max<size_t>(size / 4, 1);
+    size_t copied = 0;
+
+    uint64_t consumed = head_local;
+    while (copied < n) {
+        uint64_t available = tail.load(std::memory_order_acquire);
+        if (available == consumed) {
+            // the producer may be waiting for room that only this side knows of
+            if (consumed != head.load(std::memory_order_relaxed)) {
+                head.store(consumed, std::memory_order_release);
+                wake();
+            }
+            // finished is stored after the final tail, so recheck tail after it
+            park([&] { return tail.load(std::memory_order_acquire) != consumed || finished.load(); });
+            available = tail.load(std::memory_order_acquire);
+            if (available == consumed) break;
+        }
+
+        size_t start = consumed % size;
+        size_t span = std::min(std::min((size_t)(available - consumed), size - start), n - copied);
+        memcpy(buf + copied, &ring[start], span * sizeof(proc_inst_t));
+        consumed += span;
+        copied += span;
+        if (consumed - head.load(std::memory_order_relaxed) >= batch) {
+            head.store(consumed, std::memory_order_release);
+            wake();
+        }
+    }
+    head_local = consumed;
+    return copied;
+}
+
+InstructionSource* procsim::open_trace(int fd, size_t prefetch_depth)
+{
+    InstructionSource* mapped = MappedTraceSource::open(fd);
+    if (mapped != NULL) {
+        return mapped;
+    }
+
+    InstructionSource* text = NULL;
+    unsigned char magic[4];
+    if (pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic)) {
+        if (magic[0] == 0x1f && magic[1] == 0x8b) {
+            text = new TextTraceSource(new GzipStream(fd));
+        } else if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+#ifdef PROCSIM_HAVE_ZSTD
+            text = new TextTraceSource(new ZstdStream(fd));
+#else
+            fprintf(stderr, "zstd trace, but procsim was built without zstd (make ZSTD=1)\n");
+            return NULL;
+#endif
+        }
+    }
+    if (text == NULL) {
+        text = new TextTraceSource(fd);
+    }
+
+    if (prefetch_depth == 0) {
+        return text;
+    }
+    return new PrefetchSource(text, prefetch_depth);
+}
@@ -0,0 +1,198 @@
+#ifndef PROCSIM_TRACE_HPP
+#define PROCSIM_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include "procsim.hpp"
+
+// Binary trace layout: one trace_header_t followed by `count` fixed-size
+// trace_record_t entries. Registers and op codes fit in int8 (-1 = unused).
+#define TRACE_MAGIC "PSIMTRC\x01"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_VERSION 1
+
+typedef struct _trace_header_t
+{
+    char magic[TRACE_MAGIC_LEN];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+} trace_header_t;
+
+#pragma pack(push, 1)
+typedef struct _trace_record_t
+{
+    uint32_t instruction_address;
+    int8_t op_code;
+    int8_t dest_reg;
+    int8_t src_reg[2];
+} trace_record_t;
+#pragma pack(pop)
+
+// true if p_inst survives the int8 packing unchanged
+bool encode_record(const proc_inst_t* p_inst, trace_record_t* p_rec);
+
+inline void decode_record(const trace_record_t* p_rec, proc_inst_t* p_inst)
+{
+    p_inst->instruction_address = p_rec->instruction_address;
+    p_inst->op_code = p_rec->op_code;
+    p_inst->dest_reg = p_rec->dest_reg;
+    p_inst->src_reg[0] = p_rec->src_reg[0];
+    p_inst->src_reg[1] = p_rec->src_reg[1];
+    p_inst->tag = 0;
+}
+
+namespace procsim {
+
+// Raw bytes of a trace file, possibly decompressed on the way
+class ByteStream {
+public:
+    virtual ~ByteStream() {}
+    // returns bytes read, 0 at end of stream, -1 on error
+    virtual ssize_t read(char* buf, size_t n) = 0;
+};
+
+class FdStream : public ByteStream {
+public:
+    explicit FdStream(int fd) : fd(fd) {}
+    ssize_t read(char* buf, size_t n);
+private:
+    int fd;
+};
+
+// gzip (zlib) input
+class GzipStream : public ByteStream {
+public:
+    explicit GzipStream(int fd);
+    ~GzipStream();
+    ssize_t read(char* buf, size_t n);
+private:
+    void* file;
+};
+
+#ifdef PROCSIM_HAVE_ZSTD
+// zstd input, decompressed frame by frame
+class ZstdStream : public ByteStream {
+public:
+    explicit ZstdStream(int fd);
+    ~ZstdStream();
+    ssize_t read(char* buf, size_t n);
+private:
+    int fd;
+    void* dstream;
+    std::vector<char> in;
+    size_t in_pos;
+    size_t in_len;
+    bool in_eof;
+};
+#endif
+
+// Fetches straight out of a memory-mapped binary trace
+class MappedTraceSource : public InstructionSource {
+public:
+    // maps fd if it is a regular file starting with a binary trace header,
+    // otherwise returns NULL and leaves fd (and its file offset) untouched
+    static MappedTraceSource* open(int fd);
+    ~MappedTraceSource();
+
+    bool read(proc_inst_t* p_inst);
+    size_t read(proc_inst_t* buf, size_t n);
+    uint64_t size() const { return count; }
+
+private:
+    MappedTraceSource(void* map, size_t map_len, const trace_record_t* records, uint64_t count);
+
+    void* map;
+    size_t map_len;
+    const trace_record_t* records;
+    uint64_t count;
+    uint64_t pos;
+};
+
+// Parses text traces ("%x %d %d %d %d" per instruction, as the original
+// fscanf reader did) out of large read() blocks instead of going through stdio
+class TextTraceSource : public InstructionSource {
+public:
+    static const size_t BLOCK_SIZE = 4 << 20;
+
+    // takes over reading fd; nothing else may read from it afterwards
+    explicit TextTraceSource(int fd);
+    // parses the bytes of stream, which it then owns
+    explicit TextTraceSource(ByteStream* stream);
+    ~TextTraceSource();
+
+    bool read(proc_inst_t* p_inst);
+    size_t read(proc_inst_t* buf, size_t n);
+
+private:
+    bool fill();
+    int peek() { return (pos < end || fill()) ? (unsigned char)*pos : -1; }
+    void skip_space();
+    bool parse_hex(uint32_t* value);
+    bool parse_dec(int32_t* value);
+
+    ByteStream* stream;
+    char* block;
+    const char* pos;
+    const char* end;
+    bool eof;
+    bool failed;
+    uint64_t records;   // parsed so far, for reporting a malformed one
+};
+
+// Runs another source on a producer thread that reads and decodes ahead into
+// a single-producer/single-consumer ring, so I/O, decompression and parsing
+// stay off the simulation thread. Each side only ever writes its own index,
+// so neither takes a lock while the ring is neither empty nor full; a side
+// that finds it so spins briefly, then sleeps until the other side wakes it.
+// Both sides publish their index in batches, so the fence that pairs with a
+// sleeper is paid once per batch rather than per read.
+class PrefetchSource : public InstructionSource {
+public:
+    static const size_t DEFAULT_DEPTH = 1 << 16;
+
+    // takes ownership of inner
+    PrefetchSource(InstructionSource* inner, size_t depth = DEFAULT_DEPTH);
+    ~PrefetchSource();
+
+    bool read(proc_inst_t* p_inst);
+    size_t read(proc_inst_t* buf, size_t n);
+
+private:
+    void produce();
+    template <class Ready> void park(Ready ready);
+    void wake();
+
+    InstructionSource* inner;
+    std::vector<proc_inst_t> ring;
+    // total instructions ever consumed / produced; ring index is count % size.
+    // Padded a cache line apart so the two threads don't share one.
+    std::atomic<uint64_t> head;
+    uint64_t head_local;    // consumed, ahead of head until published
+    char head_pad[64];
+    std::atomic<uint64_t> tail;
+    char tail_pad[64];
+    std::atomic<bool> finished;
+    std::atomic<bool> stopping;
+    // only for a side that has given up spinning
+    std::atomic<unsigned> sleepers;
+    std::mutex lock;
+    std::condition_variable woken;
+    std::thread producer;
+};
+
+// Opens the trace on fd, picking the decoder from the file header: a mapped
+// binary trace, or gzip, zstd or plain text, which are read and decoded on a
+// producer thread `prefetch_depth` instructions ahead (0 reads them on the
+// calling thread)
+InstructionSource* open_trace(int fd, size_t prefetch_depth = PrefetchSource::DEFAULT_DEPTH);
+
+} // namespace procsim
+
+#endif